@@ -8,10 +8,14 @@ using Pkg
 export Spin, dim, intertwiner_range,
        VerbosityOff, LowVerbosity, HighVerbosity,
        NormalAccuracy, HighAccuracy, VeryHighAccuracy,
+       B4IntegrationLoop, B4IntegrationGEMM,
+       B4EngineAuto, B4EngineIntegrate, B4EngineFactorized,
+       B4QuadratureGK, B4QuadratureNested,
        VertexResult, Vertex, Boosters, CoherentState,
        vertex_amplitude, vertex_compute, vertex_load,
        vertex_BF_compute,
-       boosters_compute, boosters_load, b4_compute,
+       boosters_compute, boosters_load, b4_compute, b4_batch_compute,
+       B4Workspace, workspace_reset!, workspace_trim!,
        coherentstate_compute,
        contract
        
@@ -141,6 +145,15 @@ end
 "Accuracy level."
 @enum Accuracy NormalAccuracy HighAccuracy VeryHighAccuracy
 
+"Method for the integrals of the b4 coefficients."
+@enum B4Integration B4IntegrationLoop B4IntegrationGEMM
+
+"Algorithm for the b4 coefficients."
+@enum B4Engine B4EngineAuto B4EngineIntegrate B4EngineFactorized
+
+"Quadrature rule for the b4 integrals."
+@enum B4Quadrature B4QuadratureGK B4QuadratureNested
+
 "Specifies what to do at the end of a vertex computation."
 VertexResult = @NamedTuple{ret::Bool, store::Bool, store_batches::Bool}
 Base.cconvert(::Type{Cint}, vr::VertexResult) = Cint(vr[:ret] + 2 * vr[:store] + 4 * vr[:store_batches])
@@ -220,6 +233,66 @@ function get_OMP()
 
 end
 
+"Sets the maximum memory (in MB) for caching dsmall functions between b4 computations (0 disables)."
+function set_dsmall_cache(MB::Integer)
+
+    @ccall clib.sl2cfoam_set_dsmall_cache(MB::Csize_t)::Cvoid
+
+end
+
+"Enables or disables storing the computed dsmall functions on disk (disabled by default)."
+function set_dsmall_store(enable::Bool)
+
+    @ccall clib.sl2cfoam_set_dsmall_store(enable::Cbool)::Cvoid
+
+end
+
+"Sets the smallest spin l for computing the dsmall functions from their integral representation (0 disables, default)."
+function set_dsmall_integral(l_min::Spin)
+
+    @ccall clib.sl2cfoam_set_dsmall_integral(ctwo(l_min)::Cint)::Cvoid
+
+end
+
+"Enables or disables using a single integration grid for all the b4 coefficients of a booster tensor."
+function set_boosters_shared_grid(enable::Bool)
+
+    @ccall clib.sl2cfoam_set_boosters_shared_grid(enable::Cbool)::Cvoid
+
+end
+
+"Sets the method for the integrals of the b4 coefficients
+(B4IntegrationGEMM uses matrix products with BLAS, default)."
+function set_b4_integration(method::B4Integration)
+
+    @ccall clib.sl2cfoam_set_b4_integration(Int(method)::Cint)::Cvoid
+
+end
+
+"Sets the algorithm for the b4 coefficients
+(B4EngineAuto chooses the cheaper one for each spin configuration, default)."
+function set_b4_engine(engine::B4Engine)
+
+    @ccall clib.sl2cfoam_set_b4_engine(Int(engine)::Cint)::Cvoid
+
+end
+
+"Sets a target relative tolerance for the integrals of the b4 coefficients
+(integration grids are refined until it is met; 0 fixes them by accuracy, default)."
+function set_b4_tolerance(tol::Real)
+
+    @ccall clib.sl2cfoam_set_b4_tolerance(Float64(tol)::Cdouble)::Cvoid
+
+end
+
+"Sets the quadrature rule for the b4 integrals (B4QuadratureGK, default, or
+B4QuadratureNested, whose levels reuse the dsmall functions of the previous ones)."
+function set_b4_quadrature(rule::B4Quadrature)
+
+    @ccall clib.sl2cfoam_set_b4_quadrature(Int(rule)::Cint)::Cvoid
+
+end
+
 "Enables or disables internal OMP parallelization."
 function is_MPI()
 
@@ -542,6 +615,84 @@ function b4_compute(js, ls)
 end
 
 
+"Workspace with the buffers for the boosters coefficients. Passing the same
+workspace to many calls of b4_batch_compute avoids allocating memory each time.
+A workspace must not be used by concurrent calls."
+mutable struct B4Workspace
+
+    cptr :: Ptr{Cvoid}
+
+    function B4Workspace()
+
+        cptr = ccall((:sl2cfoam_b4_workspace_create, clib), Ptr{Cvoid}, ())
+        if cptr == C_NULL; error("libsl2cfoam returned a NULL pointer") end
+
+        v = new(cptr)
+        finalizer(v) do x
+            x.cptr != C_NULL && ccall((:sl2cfoam_b4_workspace_free, clib), Cvoid, (Ptr{Cvoid},), x.cptr)
+        end
+        return v
+
+    end
+
+end
+
+"Empties the workspace for a new sequence of computations, keeping its buffers
+(grown to the largest size used so far) and integration grids."
+function workspace_reset!(ws::B4Workspace)
+    ccall((:sl2cfoam_b4_workspace_reset, clib), Cvoid, (Ptr{Cvoid},), ws.cptr)
+    ws
+end
+
+"Releases all the memory held by the workspace, which can still be used."
+function workspace_trim!(ws::B4Workspace)
+    ccall((:sl2cfoam_b4_workspace_trim, clib), Cvoid, (Ptr{Cvoid},), ws.cptr)
+    ws
+end
+
+"Computes the boosters coefficients (matrices in (i,k) intertwiner indices)
+given 4 spins js and a list of spins ls (each with 4 spins l1...l4).
+The grid, the dsmall functions and the 3j symbols for the spins js are shared
+across all the computations, so this is much faster than calling b4_compute
+many times. Optionally the buffers are taken from the given workspace."
+function b4_batch_compute(js, lss, ws::Union{B4Workspace, Nothing} = nothing)
+
+    check_cinit()
+    check_spins(js, 4)
+
+    for ls in lss
+
+        check_spins(ls, 4)
+
+        for i in 1:4
+            ls[i] < js[i] && throw(ArgumentError("spin l$i = $(ls[i]) must be greater or equal $(js[i])"))
+        end
+
+    end
+
+    _, isize = intertwiner_range(js...)
+
+    # the results are written directly in the julia matrices
+    b4s = [ zeros(Float64, isize, intertwiner_range(ls...)[2]) for ls in lss ]
+
+    ctwo_ls = Cint[ ctwo(ls[i]) for ls in lss for i in 1:4 ]
+    outs = [ pointer(b4) for b4 in b4s ]
+
+    GC.@preserve b4s ws begin
+        if isnothing(ws)
+            ccall((:sl2cfoam_b4_batch, clib), Cvoid, (Cint, Cint, Cint, Cint, Csize_t, Ptr{Cint}, Ptr{Ptr{Cdouble}}), 
+                  ctwo(js[1]), ctwo(js[2]), ctwo(js[3]), ctwo(js[4]), length(lss), ctwo_ls, outs)
+        else
+            ccall((:sl2cfoam_b4_batch_ws, clib), Cvoid, (Ptr{Cvoid}, Cint, Cint, Cint, Cint, Csize_t, Ptr{Cint}, Ptr{Ptr{Cdouble}}), 
+                  ws.cptr, ctwo(js[1]), ctwo(js[2]), ctwo(js[3]), ctwo(js[4]), length(lss), ctwo_ls, outs)
+        end
+    end
+
+    b4s
+
+end
+
+
 ###################################################################
 # Coherent states functions.
 ###################################################################  
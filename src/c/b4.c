@@ -18,6 +18,7 @@
  */
 
 #include <math.h>
+#include <string.h>
 #include <complex.h>
 #include <quadmath.h>
 #include <omp.h>
@@ -30,14 +31,17 @@
 #include "utils.h"
 #include "error.h"
 #include "verb.h"
-#include "cgamma.h"
 
 #include "dsmall.h"
+#include "dsmall_cache.h"
+#include "dsmall_integral.h"
+#include "boosters.h"
+#include "b4_workspace.h"
+#include "mp_pool.h"
 #include "integration_gk.h"
 #include "blas_wrapper.h"
 #include "wigxjpf.h"
 
-TENSOR_INIT(dsmall_integral, 4);
 TENSOR_INIT(boost_wig, 3);
 
 static void dsmall_measure(double ds[], double xs[], size_t N) {
@@ -61,390 +65,2344 @@ static void dsmall_measure(double ds[], double xs[], size_t N) {
 
 }
 
-static inline __complex128 dsmall_phase(dspin two_j, dspin two_l, cgamma_lanczos* lanczos) {
+// Builds the integration grid with given endpoints (the grid takes
+// ownership of them) and the Gauss-Kronrod rule with given points
+// (level < 0) or the nested rule of given level on each interval
+// (then points must be NESTED_POINTS(level)). For the nested rule
+// the weights for the error are the ones of the previous level.
+static b4_grid* grid_create(int intervals, __float128* grid, int points, int level) {
+
+    b4_grid* g = (b4_grid*)calloc(1, sizeof(b4_grid));
+
+    int nxs = points * intervals;
+
+    g->intervals = intervals;
+    g->points = points;
+    g->level = level;
+    g->nxs = nxs;
+    g->grid = grid;
+
+    if (level < 0) {
+        g->qxs = sl2cfoam_gk_grid_abscissae(intervals, points, g->grid);
+        g->wgks = sl2cfoam_gk_grid_weights(intervals, points, g->grid);
+        g->wgs = sl2cfoam_gk_grid_weights_gauss(intervals, points, g->grid);
+    } else {
+        g->qxs = sl2cfoam_nested_grid_abscissae(intervals, g->grid, level);
+        g->wgks = sl2cfoam_nested_grid_weights(intervals, g->grid, level, level);
+        g->wgs = sl2cfoam_nested_grid_weights(intervals, g->grid, level, level - 1);
+    }
+
+    double* xs = (double*)malloc(nxs * sizeof(double));
+    for (int i = 0; i < nxs; i++) {
+        xs[i] = (double)g->qxs[i];
+    }
+
+    g->measure = (double*)malloc(nxs * sizeof(double));
+    dsmall_measure(g->measure, xs, nxs);
+
+    free(xs);
+
+    // weights times measure for the integral and for the error
+    g->wms = (double*)malloc(nxs * sizeof(double));
+    g->wdms = (double*)malloc(nxs * sizeof(double));
+    for (int i = 0; i < nxs; i++) {
+        g->wms[i] = g->wgks[i] * g->measure[i];
+        g->wdms[i] = (g->wgks[i] - g->wgs[i]) * g->measure[i];
+    }
+
+    g->dx_min = g->qxs[0];
+    for (int i = 1; i < nxs; i++) {
+        g->dx_min = fminq(g->dx_min, g->qxs[i]);
+    }
+
+    g->errs = (double*)calloc(intervals, sizeof(double));
+    g->hash = sl2cfoam_dsmall_cache_grid_hash(g->qxs, nxs);
+
+    return g;
+
+}
+
+// Returns the harmonic integration grid with given number of intervals,
+// points per interval and level of the nested rule (-1 for Gauss-Kronrod)
+// from the workspace (computed at the first call).
+static b4_grid* workspace_grid(sl2cfoam_b4_workspace* ws, int intervals, int points, int level) {
+
+    for (b4_grid* g = ws->grids; g != NULL; g = g->next) {
+        if (g->intervals == intervals && g->points == points && g->level == level) return g;
+    }
+
+    b4_grid* g = grid_create(intervals, sl2cfoam_grid_harmonic(intervals), points, level);
+
+    g->next = ws->grids;
+    ws->grids = g;
+
+    return g;
+
+}
+
+// Sets Speziale's phases of the dsmall functions for nl spins
+// l = two_ls[0] < two_ls[1] < ... The phase of
+//
+//   Gamma(j+1+i*rho) Gamma(l+1-i*rho)
+//
+// is 1 for l = j (the two factors are conjugate), so the phases
+// of all the shells follow from Gamma(z+1) = z Gamma(z).
+static void dsmall_phases(__complex128* sphs, dspin two_j, dspin* two_ls, int nl) {
+
+    double rho = RHO(SPIN(two_j));
+
+    // phase of Gamma(l+1-i*rho) / Gamma(j+1-i*rho)
+    __complex128 g = 1;
+    dspin two_l = two_j;
+
+    for (int li = 0; li < nl; li++) {
+
+        for (; two_l < two_ls[li]; two_l += 2) {
+            __complex128 z = SPIN(two_l) + 1 - I * rho;
+            g *= z / cabsq(z);
+        }
+
+        sphs[li] = g * complex_negpow(DIV2(two_ls[li]-two_j));
+
+    }
+
+}
+
+static inline void dsmall_prefactors(mpc_ptr* rop, __float128* xs, int nxs, int precision,
+                                     dspin two_j, dspin two_l, double rho) {
+
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+
+    mpc_ptr emi_r_rho_ab = sl2cfoam_mpc_borrow(precision);
+    mpc_ptr pref = sl2cfoam_mpc_borrow(precision);
+
+    mpfr_ptr emr_ab = sl2cfoam_mpfr_borrow(precision);
+    mpfr_ptr mr_rho_ab = sl2cfoam_mpfr_borrow(precision);
+
+    for (int i = 0; i < nxs; i++) {
+
+        // exp(-r)
+        mpfr_set_float128(emr_ab, xs[i], MPFR_RNDN);
+
+        // get exp(-i*r*rho)
+        mpfr_log(mr_rho_ab, emr_ab, MPFR_RNDN);
+        mpfr_mul_d(mr_rho_ab, mr_rho_ab, rho, MPFR_RNDN);
+        mpfr_sin_cos(emi_r_rho_ab->im, emi_r_rho_ab->re, mr_rho_ab, MPFR_RNDN);
+
+        // prefactor
+        mpfr_sqr(pref->re, emr_ab, MPFR_RNDN);
+        mpfr_set_ui(pref->im, 0, MPFR_RNDN);
+        mpfr_ui_sub(pref->re, 1, pref->re, MPFR_RNDN);
+        mpfr_pow_si(pref->re, pref->re, -DIV2(two_j+two_l) - 1, MPFR_RNDN);
+
+        mpc_mul(rop[i], pref, emi_r_rho_ab, MPC_RNDNN);
+
+    }
+
+    sl2cfoam_mp_release(mark);
+
+}
+
+// Precision for the dsmall functions of spins (j, l)
+// on a grid with given smallest abscissa.
+static int dsmall_precision(dspin two_ji, dspin two_li, __float128 dx_min) {
+
+    int prec_base, prec_add;
+
+    // there should be enough significant digits to cancel the prefactor
+    // (1-(1-dx)^2)^-(j1+j2+1) ~ (2*dx)^-(j1+j2+1) ...
+    prec_add = - (int)((DIV2(two_ji+two_li)+1) * log2q(2 * dx_min));
+
+    // and some more of course
+    // base precision is found by "trial and error"
+    if (two_li <= 50) {
+        prec_base = 64;
+    } else if (two_li <= 100) {
+        prec_base = 128;
+    } else {
+        prec_base = 256;
+    }
+
+    // total precision;
+    return prec_base + prec_add;
+
+}
+
+// Sets the columns p and -p of the dsmall matrix multiplying Speziale's phase
+// (only the rows with todo[i] set if todo is not NULL).
+static inline void dsmall_set_columns(sl2cfoam_cmatrix dpi, __complex128* ds, bool* todo, int nxs,
+                                      dspin two_ji, dspin two_li, dspin two_p, __complex128 sph) {
+
+    sl2cfoam_cvector dpip;
+    sl2cfoam_cvector dpipm;
+
+    int mph = real_negpow(two_ji-two_li);
+
+    // multiply phase for p and set
+    dpip = matrix_column(dpi, nxs, DIV2(two_p+two_ji));
+    for (int i = 0; i < nxs; i++) {
+        if (todo != NULL && !todo[i]) continue;
+        dpip[i] = (double complex)(ds[i] * sph);
+    }
+
+    // set the values for -p
+    dpipm = matrix_column(dpi, nxs, DIV2(-two_p+two_ji));
+    for (int i = 0; i < nxs; i++) {
+        if (todo != NULL && !todo[i]) continue;
+        dpipm[i] = (double complex)(mph * conjq(dpip[i]));
+    }
+
+}
+
+// Absolute tolerance for the dsmall functions computed
+// from the integral representation with given accuracy level.
+static double dsmall_integral_tol(int accuracy) {
+
+    switch (accuracy)
+    {
+    case SL2CFOAM_ACCURACY_NORMAL:
+        return 1e-12;
+
+    case SL2CFOAM_ACCURACY_HIGH:
+        return 1e-13;
+
+    case SL2CFOAM_ACCURACY_VERYHIGH:
+        return 1e-14;
+
+    default:
+        error("wrong accuracy value");
+    }
+
+}
+
+// Tables of the powers x^e of the abscissae for e = 0...e_max
+// in quadruple and multiple precision (NULL if no shell needs it),
+// shared by all the dsmall matrices computed on a grid.
+typedef struct dsmall_powers {
+    int e_max;
+    __float128** q;
+    mpfr_ptr** mp;
+} dsmall_powers;
+
+// Index of the column p of the dsmall matrices among the ones computed (p >= 0).
+#define P_INDEX(two_p) DIV2(two_p)
+
+// Computes the dsmall matrices d^(rho, j)_{j l p}(x) with Speziale's phase
+// for all p (columns) and all given abscissae (rows), for nl spins l
+// in ascending order (a ladder of shells). The prefactors are computed
+// once for all the spins l. For the first nq shells only the values
+// flagged in todo_q[li][P_INDEX(p) * nxs + i] are computed (the others
+// are already set). The shells with 2l >= DSMALL_INTEGRAL_TWO_L are
+// computed from the integral representation where its estimated
+// error is small enough, the remaining values with the Collet sums.
+static void dsmall_matrices_mp(sl2cfoam_b4_workspace* ws,
+                            sl2cfoam_cmatrix* dpis, dspin two_ji, dspin* two_lis, int nl,
+                            bool** todo_q, int nq,
+                            __float128* qxs, int nxs, __float128 dx_min,
+                            dsmall_powers* pows, int accuracy) {
+
+    spin ji = SPIN(two_ji);
+    double rho = RHO(ji);
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+    mp_pool_mark mp_mark = sl2cfoam_mp_mark();
+
+    // fix precision for each dsmall
+    int* precs = arena_array(arena, int, nl);
+    int prec_max = 0;
+    for (int li = 0; li < nl; li++) {
+        precs[li] = dsmall_precision(two_ji, two_lis[li], dx_min);
+        if (precs[li] > prec_max) prec_max = precs[li];
+    }
+
+    // precompute expensive prefactors for the smallest l
+    // (read by all threads, borrowed from the pool of this one)
+    mpc_ptr* prefactors = arena_array(arena, mpc_ptr, nxs);
+    sl2cfoam_mpc_borrow_array(prefactors, nxs, prec_max);
+
+    dsmall_prefactors(prefactors, qxs, nxs, prec_max, two_ji, two_lis[0], rho);
+
+    // compute Speziale's phases
+    __complex128* sphs = arena_array(arena, __complex128, nl);
+    dsmall_phases(sphs, two_ji, two_lis, nl);
+
+    // first shell for the integral representation
+    // (the ones partly computed in quadruple precision are excluded)
+    int li_int = nl;
+    if (DSMALL_INTEGRAL_TWO_L > 0) {
+        li_int = nq;
+        while (li_int < nl && two_lis[li_int] < DSMALL_INTEGRAL_TWO_L) li_int++;
+    }
+
+    // quadrature rules shared by all p
+    dsmall_integral_rules* rules = NULL;
+    double tol = 0;
+    if (li_int < nl) {
+        rules = sl2cfoam_dsmall_integral_rules(4 * (two_ji + two_lis[nl-1]) + 64);
+        tol = dsmall_integral_tol(accuracy);
+    }
+
+    #ifdef USE_OMP
+    #pragma omp parallel for if(OMP_PARALLELIZE)
+    #endif
+    for (dspin two_p = is_integer(two_ji) ? 0 : 1; two_p <= two_ji; two_p += 2) {
+
+        b4_arena* arena_p = sl2cfoam_b4_workspace_arena(ws);
+        b4_arena_mark mark_p = sl2cfoam_arena_mark(arena_p);
+        mp_pool_mark mp_mark_p = sl2cfoam_mp_mark();
+
+        __complex128** ds = arena_array(arena_p, __complex128*, nl);
+        mpc_ptr** Yms = arena_array(arena_p, mpc_ptr*, nl);
+        mpc_ptr** Yns = arena_array(arena_p, mpc_ptr*, nl);
+
+        for (int li = 0; li < nl; li++) {
+            ds[li] = arena_array(arena_p, __complex128, nxs);
+        }
+
+        // values left for the Collet sums (NULL = all)
+        bool** todo = NULL;
+        size_t left = nl * nxs;
+
+        if (nq > 0 || li_int < nl) {
+
+            todo = arena_array(arena_p, bool*, nl);
+            left = 0;
+
+            for (int li = 0; li < nl; li++) {
+
+                if (li < nq) {
+                    todo[li] = todo_q[li] + P_INDEX(two_p) * nxs;
+                    for (int i = 0; i < nxs; i++) left += todo[li][i];
+                    continue;
+                }
+
+                todo[li] = arena_array(arena_p, bool, nxs);
+                if (li < li_int) {
+                    memset(todo[li], true, nxs * sizeof(bool));
+                    left += nxs;
+                }
+
+            }
+
+            if (li_int < nl) {
+                left += sl2cfoam_dsmall_integral_ladder(ds + li_int, todo + li_int, qxs, nxs, nl - li_int,
+                                                        rules, tol, rho, two_ji, two_lis + li_int, two_p);
+            }
+
+        }
+
+        int Jmp = DIV2(abs(two_ji - two_p)); // |J-p|
+        int Jpp = DIV2(abs(two_ji + two_p)); // |J+p|
+
+        for (int li = 0; li < nl && left > 0; li++) {
+
+            dspin two_li = two_lis[li];
+
+            // no Y coefficients needed if all values are known
+            if (todo != NULL) {
+                bool any = false;
+                for (int i = 0; i < nxs && !any; i++) any = todo[li][i];
+                if (!any) continue;
+            }
+
+            // compute the Y coefficients
+            int m_max = DIV2(two_ji + two_li) - Jmp;
+            int n_max = DIV2(two_ji + two_li) - Jpp;
+
+            Yms[li] = arena_array(arena_p, mpc_ptr, m_max+1);
+            Yns[li] = arena_array(arena_p, mpc_ptr, n_max+1);
+
+            sl2cfoam_mpc_borrow_array(Yms[li], m_max+1, precs[li]);
+            sl2cfoam_mpc_borrow_array(Yns[li], n_max+1, precs[li]);
+
+            // the following functions should not be parallelized if called
+            // from booster tensor loop since nested parallelization is
+            // disabled at initialization
+
+            // compute Y coefficients
+            sl2cfoam_dsmall_Yc(Yms[li], precs[li],  rho, two_ji, two_li, two_ji,  two_p);
+            sl2cfoam_dsmall_Yc(Yns[li], precs[li], -rho, two_ji, two_ji, two_li, -two_p);
+
+        }
+
+        // compute dsmall at all points left for all l
+        if (left > 0) {
+            sl2cfoam_dsmall_ladder(ds, todo, pows->mp, nxs, nl, precs, Yms, Yns, prefactors,
+                                   rho, two_ji, two_ji, two_lis, two_p);
+        }
+
+        for (int li = 0; li < nl; li++) {
+            dsmall_set_columns(dpis[li], ds[li], li < nq ? todo[li] : NULL, nxs,
+                               two_ji, two_lis[li], two_p, sphs[li]);
+        }
+
+        // give back the Y coefficients
+        sl2cfoam_mp_release(mp_mark_p);
+        sl2cfoam_arena_release(arena_p, mark_p);
+
+    } // p
+
+    sl2cfoam_dsmall_integral_rules_free(rules);
+
+    // give back prefactors
+    sl2cfoam_mp_release(mp_mark);
+    sl2cfoam_arena_release(arena, mark);
+
+}
+
+// As dsmall_matrices_mp but in quadruple precision, setting only the values
+// whose a posteriori error estimate is small enough. The others are flagged
+// in todo[li][P_INDEX(p) * nxs + i]. Returns the number of values left.
+static size_t dsmall_matrices_q(sl2cfoam_b4_workspace* ws,
+                                sl2cfoam_cmatrix* dpis, dspin two_ji, dspin* two_lis, int nl,
+                                bool** todo, __float128* qxs, int nxs, dsmall_powers* pows) {
+
+    spin ji = SPIN(two_ji);
+    double rho = RHO(ji);
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    // prefactors for the smallest l
+    __complex128* prefactors = arena_array(arena, __complex128, nxs);
+    for (int i = 0; i < nxs; i++) {
+
+        __float128 x = qxs[i];
+        __float128 mr_rho = logq(x) * rho;
+
+        prefactors[i] = powq(1 - x*x, -DIV2(two_ji+two_lis[0]) - 1) * (cosq(mr_rho) + I * sinq(mr_rho));
+
+    }
+
+    // compute Speziale's phases
+    __complex128* sphs = arena_array(arena, __complex128, nl);
+    dsmall_phases(sphs, two_ji, two_lis, nl);
+
+    size_t left = 0;
+
+    #ifdef USE_OMP
+    #pragma omp parallel for reduction(+:left) if(OMP_PARALLELIZE)
+    #endif
+    for (dspin two_p = is_integer(two_ji) ? 0 : 1; two_p <= two_ji; two_p += 2) {
+
+        b4_arena* arena_p = sl2cfoam_b4_workspace_arena(ws);
+        b4_arena_mark mark_p = sl2cfoam_arena_mark(arena_p);
+
+        __complex128** ds = arena_array(arena_p, __complex128*, nl);
+        __complex128** Yms = arena_array(arena_p, __complex128*, nl);
+        __complex128** Yns = arena_array(arena_p, __complex128*, nl);
+        double** Yms_abs = arena_array(arena_p, double*, nl);
+        double** Yns_abs = arena_array(arena_p, double*, nl);
+        bool** todo_p = arena_array(arena_p, bool*, nl);
+
+        int Jmp = DIV2(abs(two_ji - two_p)); // |J-p|
+        int Jpp = DIV2(abs(two_ji + two_p)); // |J+p|
+
+        for (int li = 0; li < nl; li++) {
+
+            dspin two_li = two_lis[li];
+
+            ds[li] = arena_array(arena_p, __complex128, nxs);
+            todo_p[li] = todo[li] + P_INDEX(two_p) * nxs;
+
+            // compute the Y coefficients
+            int m_max = DIV2(two_ji + two_li) - Jmp;
+            int n_max = DIV2(two_ji + two_li) - Jpp;
+
+            Yms[li] = arena_array(arena_p, __complex128, m_max + 1);
+            Yns[li] = arena_array(arena_p, __complex128, n_max + 1);
+            Yms_abs[li] = arena_array(arena_p, double, m_max + 1);
+            Yns_abs[li] = arena_array(arena_p, double, n_max + 1);
+
+            sl2cfoam_dsmall_Yc_q(Yms[li], Yms_abs[li],  rho, two_ji, two_li, two_ji,  two_p);
+            sl2cfoam_dsmall_Yc_q(Yns[li], Yns_abs[li], -rho, two_ji, two_ji, two_li, -two_p);
+
+        }
+
+        // compute dsmall at all points for all l
+        left += sl2cfoam_dsmall_ladder_q(ds, todo_p, pows->q, nxs, nl, Yms, Yns, Yms_abs, Yns_abs,
+                                         prefactors, rho, two_ji, two_ji, two_lis, two_p);
+
+        // the values left are set later
+        for (int li = 0; li < nl; li++) {
+            dsmall_set_columns(dpis[li], ds[li], NULL, nxs, two_ji, two_lis[li], two_p, sphs[li]);
+        }
+
+        sl2cfoam_arena_release(arena_p, mark_p);
+
+    } // p
+
+    sl2cfoam_arena_release(arena, mark);
+
+    return left;
+
+}
+
+// Computes the dsmall matrices for a ladder of spins l in ascending order
+// with given accuracy level. The shells that need at most 113 bits of
+// precision are computed in quadruple precision, except the values
+// whose a posteriori error estimate is too large. Those values and
+// the other shells are computed with MPFR.
+static void dsmall_matrices(sl2cfoam_b4_workspace* ws,
+                            sl2cfoam_cmatrix* dpis, dspin two_ji, dspin* two_lis, int nl,
+                            __float128* qxs, int nxs, __float128 dx_min,
+                            dsmall_powers* pows, int accuracy) {
+
+    // precision grows with l
+    int nq = 0;
+    while (nq < nl && dsmall_precision(two_ji, two_lis[nq], dx_min) <= FLT128_MANT_DIG) {
+        nq++;
+    }
+
+    if (nq == 0) {
+        dsmall_matrices_mp(ws, dpis, two_ji, two_lis, nl, NULL, 0, qxs, nxs, dx_min, pows, accuracy);
+        return;
+    }
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+    mp_pool_mark mp_mark = sl2cfoam_mp_mark();
+
+    int nps = P_INDEX(two_ji) + 1;
+    bool** todo = arena_array(arena, bool*, nq);
+    for (int li = 0; li < nq; li++) {
+        todo[li] = arena_array(arena, bool, nps * nxs);
+    }
+
+    size_t left = dsmall_matrices_q(ws, dpis, two_ji, two_lis, nq, todo, qxs, nxs, pows);
+
+    // skip the shells done in quadruple precision
+    int lq = 0;
+    while (lq < nq) {
+        bool any = false;
+        for (int k = 0; k < nps * nxs && !any; k++) any = todo[lq][k];
+        if (any) break;
+        lq++;
+    }
+
+    if (left > 0 || nq < nl) {
+
+        // powers of the abscissae in multiple precision if
+        // the other shells of the grid did not need them
+        dsmall_powers pows_mp = *pows;
+        if (pows_mp.mp == NULL) {
+
+            int prec = dsmall_precision(two_ji, two_lis[nl-1], dx_min);
+
+            pows_mp.mp = arena_array(arena, mpfr_ptr*, nxs);
+            for (int i = 0; i < nxs; i++) {
+                pows_mp.mp[i] = arena_array(arena, mpfr_ptr, pows->e_max + 1);
+            }
+            sl2cfoam_dsmall_powers(pows_mp.mp, qxs, nxs, pows->e_max, prec);
+
+        }
+
+        dsmall_matrices_mp(ws, dpis + lq, two_ji, two_lis + lq, nl - lq, todo + lq, nq - lq,
+                           qxs, nxs, dx_min, &pows_mp, accuracy);
+
+    }
+
+    sl2cfoam_mp_release(mp_mark);
+    sl2cfoam_arena_release(arena, mark);
+
+}
+
+// Number of intervals for given multiplier.
+static int intervals_mult(double interval_mult, dspin two_l_max) {
+
+    // TODO: better study of this criterion
+    //       maybe no less than 2 intervals (~120 points) to begin with?
+    double glmax = SPIN(two_l_max) * fmax(1.0, sqrt(IMMIRZI));
+    return max(1, floor(interval_mult * sqrt(glmax)));
+
+}
+
+// multiplier of the grid for the highest accuracy
+#define INTERVAL_MULT_VERYHIGH 4.0
+
+int sl2cfoam_b4_intervals(dspin two_l_max) {
+
+    // set the number of intervals for integration
+    // (next variable looks ok even as low as 1 for most cases...)
+
+    double interval_mult;
+
+    if (B4_QUADRATURE == SL2CFOAM_B4_QUADRATURE_NESTED) {
+
+        // the same intervals for all accuracies and tolerances,
+        // these select the level of the rule (see nested_level)
+        interval_mult = 1.5;
+
+    } else if (B4_TOLERANCE > 0) {
+
+        // start coarse, the grid is refined until
+        // the tolerance is met (see sl2cfoam_b4_batch_grid)
+        interval_mult = 1.0;
+
+    } else {
+
+        switch (ACCURACY)
+        {
+        case SL2CFOAM_ACCURACY_NORMAL:
+            interval_mult = 1.5;
+            break;
+
+        case SL2CFOAM_ACCURACY_HIGH:
+            interval_mult = 2.5;
+            break;
+
+        case SL2CFOAM_ACCURACY_VERYHIGH:
+            interval_mult = INTERVAL_MULT_VERYHIGH;
+            break;
+        
+        default:
+            error("wrong accuracy value");
+        }
+
+    }
+
+    return intervals_mult(interval_mult, two_l_max);
+
+}
+
+// Gauss-Kronrod rules smaller than the default one.
+static const int b4_rules_points[5] = { 15, 21, 31, 41, 51 };
+
+// Smallest spin 2j for which each rule above integrates the b4
+// coefficients with equal spins j as well as the default rule on the
+// grid given by sl2cfoam_b4_intervals (0 if never), for each accuracy
+// and for Immirzi parameter up to 2, up to 5 and up to 20 (found
+// numerically). The integrands get smoother as j grows and oscillate
+// faster as the Immirzi parameter grows; the spins l do not matter
+// much since the grid is refined for them.
+static const dspin b4_rules_two_j[3][3][5] = {
+    { { 0, 8, 6, 6, 5 }, { 0, 0, 7, 6, 5 }, { 0, 0, 0, 16, 5 } }, // NORMAL
+    { { 7, 6, 5, 4, 4 }, { 0, 6, 5, 4, 4 }, { 0, 0, 8,  4, 4 } }, // HIGH
+    { { 5, 5, 4, 4, 3 }, { 5, 5, 4, 4, 3 }, { 0, 0, 4,  4, 4 } }  // VERYHIGH
+};
+
+int sl2cfoam_b4_points(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4) {
+
+    // start from the default rule if refining to meet a tolerance
+    // (see sl2cfoam_b4_batch_grid)
+    if (B4_TOLERANCE > 0) return GK_POINTS;
+
+    // with different spins the integrands are much less regular
+    // and the default rule is kept
+    if (two_j1 != two_j2 || two_j1 != two_j3 || two_j1 != two_j4) return GK_POINTS;
+
+    int gi;
+    if (IMMIRZI <= 2.0) {
+        gi = 0;
+    } else if (IMMIRZI <= 5.0) {
+        gi = 1;
+    } else if (IMMIRZI <= 20.0) {
+        gi = 2;
+    } else {
+        return GK_POINTS;
+    }
+
+    const dspin* two_js = b4_rules_two_j[ACCURACY][gi];
+
+    for (int r = 0; r < 5; r++) {
+        if (two_js[r] > 0 && two_j1 >= two_js[r]) return b4_rules_points[r];
+    }
+
+    return GK_POINTS;
+
+}
+
+// lowest and highest levels of the nested rule
+#define NESTED_LEVEL_MIN 1
+#define NESTED_LEVEL_MAX 5
+
+// Returns the level of the nested rule for the accuracy
+// (the lowest one if refining to meet a tolerance).
+// These are the lowest levels never less accurate than the
+// Gauss-Kronrod grids at the same accuracy, for Immirzi parameter
+// from 0.2 to 15 (found numerically, up to rounding errors).
+static int nested_level() {
+
+    if (B4_TOLERANCE > 0) return NESTED_LEVEL_MIN;
+
+    switch (ACCURACY)
+    {
+    case SL2CFOAM_ACCURACY_NORMAL:
+        return 3;
+
+    case SL2CFOAM_ACCURACY_HIGH:
+        return 3;
+
+    case SL2CFOAM_ACCURACY_VERYHIGH:
+        return 4;
+    
+    default:
+        error("wrong accuracy value");
+    }
+
+}
+
+// Returns the accuracy level of the dsmall functions on a grid.
+// On the nested grids this is the highest one, so that the
+// functions can be reused by all the levels of the rule.
+static inline int dsmall_accuracy(b4_grid* g) {
+    return (g->level < 0 ? ACCURACY : SL2CFOAM_ACCURACY_VERYHIGH);
+}
+
+sl2cfoam_dmatrix sl2cfoam_b4(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                             dspin two_l1, dspin two_l2, dspin two_l3, dspin two_l4) {
+
+    dspin two_ls[4] = { two_l1, two_l2, two_l3, two_l4 };
+
+    dspin two_i_min = max(abs(two_j1-two_j2), abs(two_j3-two_j4));
+    dspin two_i_max = min(two_j1+two_j2, two_j3+two_j4);
+    dspin two_k_min = max(abs(two_l1-two_l2), abs(two_l3-two_l4));
+    dspin two_k_max = min(two_l1+two_l2, two_l3+two_l4);
+
+    int dimi = DIV2(two_i_max-two_i_min) + 1;
+    int dimk = DIV2(two_k_max-two_k_min) + 1;
+
+    // final b4 matrix in indices (i, k)
+    sl2cfoam_dmatrix b4 = dmatrix_alloc(dimi, dimk);
+
+    sl2cfoam_b4_batch(two_j1, two_j2, two_j3, two_j4, 1, two_ls, &b4);
+
+    return b4;
+
+}
+
+void sl2cfoam_b4_batch(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                       size_t n, dspin* two_ls, sl2cfoam_dmatrix* outs) {
+
+    sl2cfoam_b4_workspace* ws = sl2cfoam_b4_workspace_create();
+
+    sl2cfoam_b4_batch_ws(ws, two_j1, two_j2, two_j3, two_j4, n, two_ls, outs);
+
+    sl2cfoam_b4_workspace_free(ws);
+
+}
+
+void sl2cfoam_b4_batch_ws(sl2cfoam_b4_workspace* ws,
+                          dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                          size_t n, dspin* two_ls, sl2cfoam_dmatrix* outs) {
+
+    if (n == 0) return;
+
+    sl2cfoam_b4_workspace_enter(ws);
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    // the Gauss-Kronrod rule depends only on the spins j
+    int points = sl2cfoam_b4_points(two_j1, two_j2, two_j3, two_j4);
+
+    // group the l-tuples with the same grid
+    int* intervals = arena_array(arena, int, n);
+    for (size_t t = 0; t < n; t++) {
+        dspin* ls = &two_ls[4*t];
+        intervals[t] = sl2cfoam_b4_intervals(max4(ls[0], ls[1], ls[2], ls[3]));
+    }
+
+    dspin* group_ls = arena_array(arena, dspin, 4 * n);
+    sl2cfoam_dmatrix* group_outs = arena_array(arena, sl2cfoam_dmatrix, n);
+    bool* done = arena_array(arena, bool, n);
+
+    for (size_t t0 = 0; t0 < n; t0++) {
+
+        if (done[t0]) continue;
+
+        size_t group_size = 0;
+        for (size_t t = t0; t < n; t++) {
+
+            if (done[t] || intervals[t] != intervals[t0]) continue;
+
+            memcpy(&group_ls[4*group_size], &two_ls[4*t], 4 * sizeof(dspin));
+            group_outs[group_size] = outs[t];
+            group_size++;
+            done[t] = true;
+
+        }
+
+        sl2cfoam_b4_batch_grid(ws, two_j1, two_j2, two_j3, two_j4,
+                               group_size, group_ls, group_outs, intervals[t0], points);
+
+    }
+
+    sl2cfoam_arena_release(arena, mark);
+
+}
+
+// Ranges of the magnetic indices in the block with q = p1 + p2 = - p3 - p4.
+// Returns false if the block is empty.
+static inline bool q_block(dspin two_q, dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                           dspin* two_p1_min, dspin* two_p1_max, 
+                           dspin* two_p3_min, dspin* two_p3_max) {
+
+    *two_p1_min = max(-two_j1, two_q - two_j2);
+    *two_p1_max = min(two_j1, two_q + two_j2);
+    *two_p3_min = max(-two_j3, -two_q - two_j4);
+    *two_p3_max = min(two_j3, -two_q + two_j4);
+
+    return (*two_p1_max >= *two_p1_min && *two_p3_max >= *two_p3_min);
+
+}
+
+// Symmetry p -> -p. The dsmall functions satisfy
+//
+//   d_{-p}(x) = (-1)^(j - l) conj(d_p(x))
+//
+// so the integral of the real part of the product for (-p1, -p2, -p3, -p4)
+// equals the one for (p1, p2, p3, p4) times (-1)^(j1 + j2 + j3 + j4 - l1 - l2 - l3 - l4).
+// Flipping all magnetic indices the 3j symbols give the sign
+// (-1)^(j1 + j2 + j3 + j4 + 2i) (-1)^(l1 + l2 + l3 + l4 + 2k). Since i and k are 
+// both integers or both half-integers the block with -q contributes to b4
+// exactly as the block with q. Only the blocks with q >= 0 are computed
+// and the ones with q > 0 are counted twice.
+
+// Number of blocks with q >= 0.
+static inline int q_blocks(dspin two_q_max) {
+    return DIV2(two_q_max) + 1;
+}
+
+// Total magnetic number of the qi-th block with q >= 0.
+static inline dspin q_of_block(dspin two_q_max, int qi) {
+    return (two_q_max % 2) + 2 * qi;
+}
+
+// Multiplicity of the block with given q.
+static inline double q_weight(dspin two_q) {
+    return two_q == 0 ? 1.0 : 2.0;
+}
+
+// Integrals of the products of 4 dsmall functions. Only the ones
+// with p1 + p2 + p3 + p4 = 0 are non-zero, so they are stored in blocks
+// of fixed q = p1 + p2 = - p3 - p4 >= 0. The block qi is the
+// (dima x dimb) matrix I(a, b) with a = (p1 - p1_min) / 2 and
+// b = (p3 - p3_min) / 2, starting at offsets[qi].
+// The memory is taken from an arena.
+typedef struct dsmall_integrals {
+    dspin two_j1, two_j2, two_j3, two_j4;
+    dspin two_q_max;
+    size_t* offsets;
+    double* d;
+} dsmall_integrals;
+
+static dsmall_integrals* dsmall_integrals_create(b4_arena* arena,
+                                                 dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4) {
+
+    dsmall_integrals* di = arena_array(arena, dsmall_integrals, 1);
+
+    di->two_j1 = two_j1;
+    di->two_j2 = two_j2;
+    di->two_j3 = two_j3;
+    di->two_j4 = two_j4;
+    di->two_q_max = min(two_j1+two_j2, two_j3+two_j4);
+
+    int dimq = q_blocks(di->two_q_max);
+    di->offsets = arena_array(arena, size_t, dimq + 1);
+
+    size_t size = 0;
+    for (int qi = 0; qi < dimq; qi++) {
+
+        di->offsets[qi] = size;
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(q_of_block(di->two_q_max, qi), two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        size += (size_t)(DIV2(two_p1_max - two_p1_min) + 1) * (DIV2(two_p3_max - two_p3_min) + 1);
+
+    }
+    di->offsets[dimq] = size;
+
+    di->d = arena_dmatrix(arena, size, 1);
+
+    return di;
+
+}
+
+// Returns the block of integrals with index qi.
+static inline sl2cfoam_dmatrix dsmall_integrals_block(dsmall_integrals* di, int qi) {
+    return di->d + di->offsets[qi];
+}
+
+// relative error threshold in integration for prompting a warning
+#define GK_TOL 0.01
+
+// the dsmall integral can be exactly zero by certain symmetries
+// so if we find that the error is large and the value is very small
+// then it is probably just numerical noise
+#define INTEGRAL_ZERO 1e-16
+
+// maximum number of integration warnings per thread
+#define WARN_MAX_PER_THREAD 10
+
+// Checks the error of a dsmall integral, prints a warning if too large
+// (unless the grid is refined to meet a tolerance).
+// Returns the value to be set in the dsmall tensor.
+static inline double check_integral(double res, double abserr, int* wcount,
+                                    dspin two_p1, dspin two_p2, dspin two_p3, dspin two_p4) {
+
+    double absres = fabs(res);
+    if (abserr >= GK_TOL * absres) {
+
+        if (absres < INTEGRAL_ZERO) {
+
+            // this is numerical noise
+            // do not bother and leave the integral to 0 exactly
+            return 0.0;
+
+        }
+
+        if (B4_TOLERANCE > 0) return res;
+
+        (*wcount)++;
+        if (*wcount <= WARN_MAX_PER_THREAD) {
+
+            // probably worth a warning
+            if (*wcount < WARN_MAX_PER_THREAD) {
+                warning("gk integral (pi) = (%d, %d, %d, %d) relative error = %.3g >= %.3g (integral = %.3g)",
+                    two_p1, two_p2, two_p3, two_p4, abserr/absres, GK_TOL, res);
+            } else {
+                warning("gk integral (pi) = (%d, %d, %d, %d) relative error = %.3g >= %.3g (integral = %.3g)\n"
+                        "(further warnings for integration on this thread not shown...)",
+                        two_p1, two_p2, two_p3, two_p4, abserr/absres, GK_TOL, res);
+            }
+            
+        }
+        
+    }
+
+    return res;
+
+}
+
+// Relative error of a value with respect to the largest one of a set:
+// the errors of the values smaller than GK_TOL times the largest
+// are compared with GK_TOL times the largest.
+static inline double relative_error(double res, double abserr, double res_max) {
+
+    if (res_max < INTEGRAL_ZERO) return 0.0;
+    return abserr / fmax(fabs(res), GK_TOL * res_max);
+
+}
+
+// Largest absolute value of the integrals of a q block.
+static inline double block_max(sl2cfoam_dmatrix Iq, int dima, int dimb) {
+
+    double res_max = 0.0;
+    for (int k = 0; k < dima * dimb; k++) {
+        res_max = fmax(res_max, fabs(Iq[k]));
+    }
+
+    return res_max;
+
+}
+
+// Largest relative error of the integrals of a q block,
+// with the absolute errors in errs (leading dimension ld).
+static double block_error(sl2cfoam_dmatrix Iq, int dima, int dimb, double res_max,
+                          double* errs, int ld) {
+
+    double err = 0.0;
+    for (int bi = 0; bi < dimb; bi++) {
+    for (int ai = 0; ai < dima; ai++) {
+        err = fmax(err, relative_error(matrix_get(Iq, dima, ai, bi), fabs(errs[ai + ld * bi]), res_max));
+    }
+    }
+
+    return err;
+
+}
+
+// Records the relative error of some integrals in the workspace.
+static inline void workspace_gk_error(sl2cfoam_b4_workspace* ws, double err) {
+
+    #ifdef USE_OMP
+    #pragma omp critical (b4_gk_err)
+    #endif
+    ws->gk_err = fmax(ws->gk_err, err);
+
+}
+
+// Returns if the errors on each interval are needed, for bisecting
+// the intervals of a Gauss-Kronrod grid to meet the tolerance.
+static inline bool interval_errors(b4_grid* g) {
+    return (B4_TOLERANCE > 0 && g->level < 0);
+}
+
+// Records the relative errors of some integrals on each interval of the grid.
+static inline void grid_gk_errors(b4_grid* g, double* errs) {
+
+    #ifdef USE_OMP
+    #pragma omp critical (b4_gk_err)
+    #endif
+    for (int k = 0; k < g->intervals; k++) {
+        g->errs[k] = fmax(g->errs[k], errs[k]);
+    }
+
+}
+
+// Computes the dsmall integrals with a loop over the p tuples of each q block
+// and a (compensated) sum over the abscissae for each of them.
+static void dsmall_integrals_loop(sl2cfoam_b4_workspace* ws, dsmall_integrals* di, b4_grid* g,
+                                  sl2cfoam_cmatrix dp1, sl2cfoam_cmatrix dp2,
+                                  sl2cfoam_cmatrix dp3, sl2cfoam_cmatrix dp4) {
+
+    dspin two_j1 = di->two_j1;
+    dspin two_j2 = di->two_j2;
+    dspin two_j3 = di->two_j3;
+    dspin two_j4 = di->two_j4;
+
+    int nxs = g->nxs;
+    int dimq = q_blocks(di->two_q_max);
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
+
+    int wcount = 0;
+    double gk_err = 0.0;
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    double* prod = arena_array(arena, double, nxs);
+
+    // errors of a q block
+    size_t dimab_max = min(DIM(two_j1), DIM(two_j2)) * min(DIM(two_j3), DIM(two_j4));
+    double* errs = arena_array(arena, double, dimab_max);
+
+    // errors of a q block on each interval (for refining the grid)
+    double* errs_int = NULL;
+    double* errs_p = NULL;
+    double* gk_errs = NULL;
+    if (interval_errors(g)) {
+        errs_int = arena_array(arena, double, g->intervals * dimab_max);
+        errs_p = arena_array(arena, double, g->intervals);
+        gk_errs = arena_array(arena, double, g->intervals);
+    }
+
+    #ifdef USE_OMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (int qi = 0; qi < dimq; qi++) {
+
+        dspin two_q = q_of_block(di->two_q_max, qi);
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(two_q, two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        int dima = DIV2(two_p1_max - two_p1_min) + 1;
+        int dimb = DIV2(two_p3_max - two_p3_min) + 1;
+        sl2cfoam_dmatrix Iq = dsmall_integrals_block(di, qi);
+
+        for (dspin two_p3 = two_p3_min; two_p3 <= two_p3_max; two_p3 += 2) {
+        for (dspin two_p1 = two_p1_min; two_p1 <= two_p1_max; two_p1 += 2) {
+
+            dspin two_p2 = two_q - two_p1;
+            dspin two_p4 = -two_q - two_p3;
+
+            int p1i, p2i, p3i, p4i;
+            p1i = DIV2(two_p1+two_j1);
+            p2i = DIV2(two_p2+two_j2);
+            p3i = DIV2(two_p3+two_j3);
+            p4i = DIV2(two_p4+two_j4);
+
+            // multiply and then take real part
+            double complex cprod;
+            for (int i = 0; i < nxs; i++) {
+
+                cprod = (matrix_column(dp1, nxs, p1i))[i] * 
+                        (matrix_column(dp2, nxs, p2i))[i] *
+                        (matrix_column(dp3, nxs, p3i))[i] *
+                        (matrix_column(dp4, nxs, p4i))[i];
+                prod[i] = creal(cprod);
+
+            }
+
+            double res, abserr;
+
+            res = sl2cfoam_gk_grid(g->intervals, g->points, prod, g->measure, g->wgks, g->wgs, &abserr);
+            res = check_integral(res, abserr, &wcount, two_p1, two_p2, two_p3, two_p4);
+
+            // set real part (should be) in the q block
+            matrix_get(Iq, dima, DIV2(two_p1-two_p1_min), DIV2(two_p3-two_p3_min)) = res;
+            matrix_get(errs, dima, DIV2(two_p1-two_p1_min), DIV2(two_p3-two_p3_min)) = abserr;
+
+            if (errs_int != NULL) {
+
+                sl2cfoam_gk_grid_errors(g->intervals, g->points, prod, g->measure, g->wgks, g->wgs, errs_p);
+
+                for (int k = 0; k < g->intervals; k++) {
+                    double* errs_k = errs_int + k * dimab_max;
+                    matrix_get(errs_k, dima, DIV2(two_p1-two_p1_min), DIV2(two_p3-two_p3_min)) = errs_p[k];
+                }
+
+            }
+
+        } // p1
+        } // p3
+
+        double res_max = block_max(Iq, dima, dimb);
+        gk_err = fmax(gk_err, block_error(Iq, dima, dimb, res_max, errs, dima));
+
+        if (errs_int != NULL) {
+            for (int k = 0; k < g->intervals; k++) {
+                gk_errs[k] = fmax(gk_errs[k], block_error(Iq, dima, dimb, res_max, errs_int + k * dimab_max, dima));
+            }
+        }
+
+    } // q
+
+    workspace_gk_error(ws, gk_err);
+    if (gk_errs != NULL) grid_gk_errors(g, gk_errs);
+
+    sl2cfoam_arena_release(arena, mark);
+
+    #ifdef USE_OMP
+    } // omp parallel
+    #endif
+
+}
+
+// Computes the dsmall integrals with matrix products in blocks 
+// of fixed q = p1 + p2 = - p3 - p4. With pairs a = (p1, p2), b = (p3, p4)
+// and P(x, a) = d1 d2, Q(x, b) = d3 d4 the integrals are
+//
+//   I(a, b) = sum_x w_x m_x Re(P(x, a) Q(x, b))
+//           = sum_x w_x m_x (Re P Re Q - Im P Im Q)
+//
+// so stacking real and imaginary parts along x this is a single DGEMM.
+// The errors are computed in the same product using the difference
+// between Kronrod and Gauss weights.
+static void dsmall_integrals_gemm(sl2cfoam_b4_workspace* ws, dsmall_integrals* di, b4_grid* g,
+                                  sl2cfoam_cmatrix dp1, sl2cfoam_cmatrix dp2,
+                                  sl2cfoam_cmatrix dp3, sl2cfoam_cmatrix dp4) {
+
+    dspin two_j1 = di->two_j1;
+    dspin two_j2 = di->two_j2;
+    dspin two_j3 = di->two_j3;
+    dspin two_j4 = di->two_j4;
+
+    int nxs = g->nxs;
+    double* wms = g->wms;
+    double* wdms = g->wdms;
+
+    dspin two_q_max = di->two_q_max;
+    int dimq = q_blocks(two_q_max);
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
+
+    int wcount = 0;
+    double gk_err = 0.0;
+
+    size_t dima_max = min(DIM(two_j1), DIM(two_j2));
+    size_t dimb_max = min(DIM(two_j3), DIM(two_j4));
+
+    // A = [ w Re P  wd Re P ; - w Im P  - wd Im P ] (2 nxs x 2 dima)
+    // B = [ Re Q ; Im Q ] (2 nxs x dimb)
+    // C = A^T B = [ I ; err ] (2 dima x dimb)
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    sl2cfoam_dmatrix A = arena_dmatrix(arena, 2 * nxs, 2 * dima_max);
+    sl2cfoam_dmatrix B = arena_dmatrix(arena, 2 * nxs, dimb_max);
+    sl2cfoam_dmatrix C = arena_dmatrix(arena, 2 * dima_max, dimb_max);
+
+    // errors on each interval (for refining the grid)
+    sl2cfoam_dmatrix E = NULL;
+    double* gk_errs = NULL;
+    if (interval_errors(g)) {
+        E = arena_dmatrix(arena, dima_max, dimb_max);
+        gk_errs = arena_array(arena, double, g->intervals);
+    }
+
+    #ifdef USE_OMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (int qi = 0; qi < dimq; qi++) {
+
+        dspin two_q = q_of_block(two_q_max, qi);
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(two_q, two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        int dima = DIV2(two_p1_max - two_p1_min) + 1;
+        int dimb = DIV2(two_p3_max - two_p3_min) + 1;
+
+        for (dspin two_p1 = two_p1_min; two_p1 <= two_p1_max; two_p1 += 2) {
+
+            int ai = DIV2(two_p1 - two_p1_min);
+
+            sl2cfoam_cvector d1 = matrix_column(dp1, nxs, DIV2(two_p1+two_j1));
+            sl2cfoam_cvector d2 = matrix_column(dp2, nxs, DIV2(two_q-two_p1+two_j2));
+
+            double* Aw  = matrix_column(A, 2 * nxs, ai);
+            double* Awd = matrix_column(A, 2 * nxs, (dima + ai));
+
+            for (int i = 0; i < nxs; i++) {
+
+                double complex P = d1[i] * d2[i];
+
+                Aw[i]        =  wms[i] * creal(P);
+                Aw[nxs + i]  = -wms[i] * cimag(P);
+                Awd[i]       =  wdms[i] * creal(P);
+                Awd[nxs + i] = -wdms[i] * cimag(P);
+
+            }
+
+        }
+
+        for (dspin two_p3 = two_p3_min; two_p3 <= two_p3_max; two_p3 += 2) {
+
+            int bi = DIV2(two_p3 - two_p3_min);
+
+            sl2cfoam_cvector d3 = matrix_column(dp3, nxs, DIV2(two_p3+two_j3));
+            sl2cfoam_cvector d4 = matrix_column(dp4, nxs, DIV2(-two_q-two_p3+two_j4));
+
+            double* Bq = matrix_column(B, 2 * nxs, bi);
+
+            for (int i = 0; i < nxs; i++) {
+
+                double complex Q = d3[i] * d4[i];
+
+                Bq[i]       = creal(Q);
+                Bq[nxs + i] = cimag(Q);
+
+            }
+
+        }
+
+        BLASW_DGEMM_TN(1.0, 0.0, 2 * dima, dimb, 2 * nxs, A, 2 * nxs, B, 2 * nxs, C, 2 * dima);
+
+        sl2cfoam_dmatrix Iq = dsmall_integrals_block(di, qi);
+
+        for (dspin two_p3 = two_p3_min; two_p3 <= two_p3_max; two_p3 += 2) {
+        for (dspin two_p1 = two_p1_min; two_p1 <= two_p1_max; two_p1 += 2) {
+
+            dspin two_p2 = two_q - two_p1;
+            dspin two_p4 = -two_q - two_p3;
+
+            int ai = DIV2(two_p1 - two_p1_min);
+            int bi = DIV2(two_p3 - two_p3_min);
+
+            double res = matrix_get(C, 2 * dima, ai, bi);
+            double abserr = fabs(matrix_get(C, 2 * dima, dima + ai, bi));
+
+            matrix_get(Iq, dima, ai, bi) = check_integral(res, abserr, &wcount, 
+                                                          two_p1, two_p2, two_p3, two_p4);
+
+        } // p1
+        } // p3
+
+        // errors are in the rows below the integrals
+        double res_max = block_max(Iq, dima, dimb);
+        gk_err = fmax(gk_err, block_error(Iq, dima, dimb, res_max, C + dima, 2 * dima));
+
+        if (E != NULL) {
+
+            // the errors on each interval are the same products
+            // restricted to the rows of its abscissae
+            double* Awd = matrix_column(A, 2 * nxs, dima);
+
+            for (int k = 0; k < g->intervals; k++) {
+
+                int x0 = k * g->points;
+
+                BLASW_DGEMM_TN(1.0, 0.0, dima, dimb, g->points, Awd + x0, 2 * nxs, B + x0, 2 * nxs, E, dima);
+                BLASW_DGEMM_TN(1.0, 1.0, dima, dimb, g->points, Awd + nxs + x0, 2 * nxs, B + nxs + x0, 2 * nxs, E, dima);
+
+                gk_errs[k] = fmax(gk_errs[k], block_error(Iq, dima, dimb, res_max, E, dima));
+
+            }
+
+        }
+
+    } // q
+
+    workspace_gk_error(ws, gk_err);
+    if (gk_errs != NULL) grid_gk_errors(g, gk_errs);
+
+    sl2cfoam_arena_release(arena, mark);
+
+    #ifdef USE_OMP
+    } // omp parallel
+    #endif
+
+}
+
+// Fills the products of 3j symbols for the block with given q
+// U(a, ik) = 3j(j1 j2 i) 3j(l1 l2 k) with a = (p1, p2) and
+// V(b, ik) = 3j(i j3 j4) 3j(k l3 l4) with b = (p3, p4).
+static inline void fill_3j_products(sl2cfoam_dmatrix U, sl2cfoam_dmatrix V, dspin two_q,
+                                    dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                                    dspin two_p1_min, dspin two_p1_max, 
+                                    dspin two_p3_min, dspin two_p3_max,
+                                    int dimi, int dimk, int k12_offset, int k34_offset,
+                                    tensor_ptr(boost_wig) wt_ip1p2, tensor_ptr(boost_wig) wt_ip3p4,
+                                    tensor_ptr(boost_wig) wt_kp1p2, tensor_ptr(boost_wig) wt_kp3p4) {
+
+    int dima = DIV2(two_p1_max - two_p1_min) + 1;
+    int dimb = DIV2(two_p3_max - two_p3_min) + 1;
+
+    for (int ki = 0; ki < dimk; ki++) {
+    for (int ii = 0; ii < dimi; ii++) {
+
+        int iki = ii + dimi * ki;
+
+        for (dspin two_p1 = two_p1_min; two_p1 <= two_p1_max; two_p1 += 2) {
+
+            int p1i = DIV2(two_p1+two_j1);
+            int p2i = DIV2(two_q-two_p1+two_j2);
+
+            matrix_get(U, dima, DIV2(two_p1-two_p1_min), iki) = 
+                TENSOR_GET(wt_ip1p2, 3, ii, p1i, p2i) * TENSOR_GET(wt_kp1p2, 3, ki + k12_offset, p1i, p2i);
+
+        }
+
+        for (dspin two_p3 = two_p3_min; two_p3 <= two_p3_max; two_p3 += 2) {
+
+            int p3i = DIV2(two_p3+two_j3);
+            int p4i = DIV2(-two_q-two_p3+two_j4);
+
+            matrix_get(V, dimb, DIV2(two_p3-two_p3_min), iki) = 
+                TENSOR_GET(wt_ip3p4, 3, ii, p3i, p4i) * TENSOR_GET(wt_kp3p4, 3, ki + k34_offset, p3i, p4i);
+
+        }
+
+    } // i
+    } // k
+
+}
+
+// Estimates if the factorized engine is cheaper than integrating
+// the dsmall products first, counting the multiply-adds of both
+// algorithms for all the q blocks.
+static bool factorized_cheaper(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                               int dimik, int nxs) {
+
+    double cost_integrate = 0.0;
+    double cost_factorized = 0.0;
+
+    dspin two_q_max = min(two_j1+two_j2, two_j3+two_j4);
+
+    for (int qi = 0; qi < q_blocks(two_q_max); qi++) {
+
+        dspin two_q = q_of_block(two_q_max, qi);
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(two_q, two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        double dima = DIV2(two_p1_max - two_p1_min) + 1;
+        double dimb = DIV2(two_p3_max - two_p3_min) + 1;
+
+        // integrals (with errors) then matrix product with the 3j symbols
+        cost_integrate += dima * dimb * (4.0 * nxs + dimik);
+
+        // contraction of the 3j symbols at each abscissa then sum
+        cost_factorized += 2.0 * nxs * dimik * (dima + dimb + 2.0);
+
+    }
+
+    return cost_factorized < cost_integrate;
+
+}
+
+// Assembles the b4 matrix (up to the factors depending on (i, k))
+// from the dsmall integrals. The sum over all ps is done in blocks
+// with fixed q = p1 + p2 = - p3 - p4. With pairs a = (p1, p2) and 
+// b = (p3, p4) the sum for each q reads
+//
+//   sum_a U(a, ik) sum_b I(a, b) V(b, ik)
+//
+// where I(a, b) are the integrals, so the inner sum is a matrix product.
+static void b4_assemble(sl2cfoam_b4_workspace* ws, sl2cfoam_dmatrix b4, dsmall_integrals* di,
+                        int dimi, int dimk, int k12_offset, int k34_offset,
+                        tensor_ptr(boost_wig) wt_ip1p2, tensor_ptr(boost_wig) wt_ip3p4,
+                        tensor_ptr(boost_wig) wt_kp1p2, tensor_ptr(boost_wig) wt_kp3p4) {
+
+    dspin two_j1 = di->two_j1;
+    dspin two_j2 = di->two_j2;
+    dspin two_j3 = di->two_j3;
+    dspin two_j4 = di->two_j4;
+
+    int dimik = dimi * dimk;
+
+    dspin two_q_max = di->two_q_max;
+    int dimq = q_blocks(two_q_max);
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
+
+    // I need temporary arrays for each thread for reduction
+    // and for the matrices of each q block
+    size_t dima_max = min(DIM(two_j1), DIM(two_j2));
+    size_t dimb_max = min(DIM(two_j3), DIM(two_j4));
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    sl2cfoam_dmatrix b4_thread = arena_dmatrix(arena, dimi, dimk);
+    sl2cfoam_dmatrix U = arena_dmatrix(arena, dima_max, dimik);
+    sl2cfoam_dmatrix V = arena_dmatrix(arena, dimb_max, dimik);
+    sl2cfoam_dmatrix M = arena_dmatrix(arena, dima_max, dimik);
+
+    #ifdef USE_OMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (int qi = 0; qi < dimq; qi++) {
+
+        dspin two_q = q_of_block(two_q_max, qi);
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(two_q, two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        int dima = DIV2(two_p1_max - two_p1_min) + 1;
+        int dimb = DIV2(two_p3_max - two_p3_min) + 1;
+
+        // integrals for this block
+        sl2cfoam_dmatrix Iq = dsmall_integrals_block(di, qi);
+
+        bool all_zero = true;
+        for (int abi = 0; abi < dima * dimb; abi++) {
+            if (Iq[abi] != 0.0) {
+                all_zero = false;
+                break;
+            }
+        }
+
+        if (all_zero) continue;
+
+        fill_3j_products(U, V, two_q, two_j1, two_j2, two_j3, two_j4,
+                         two_p1_min, two_p1_max, two_p3_min, two_p3_max,
+                         dimi, dimk, k12_offset, k34_offset,
+                         wt_ip1p2, wt_ip3p4, wt_kp1p2, wt_kp3p4);
+
+        // M = I * V
+        BLASW_DGEMM_NN(1.0, 0.0, dima, dimik, dimb, Iq, dima, V, dimb, M, dima);
+
+        // contract with U
+        double factor_q = q_weight(two_q) * real_negpow(2 * two_q);
+        for (int iki = 0; iki < dimik; iki++) {
+
+            double sum = 0.0;
+            for (int ai = 0; ai < dima; ai++) {
+                sum += matrix_get(U, dima, ai, iki) * matrix_get(M, dima, ai, iki);
+            }
+
+            b4_thread[iki] += factor_q * sum;
+
+        }
+
+    } // q
+
+    // reduce over all threads
+    #ifdef USE_OMP
+    #pragma omp critical
+    {
+    #endif
+
+    for (int iki = 0; iki < dimik; iki++) {
+        b4[iki] += b4_thread[iki];
+    }
+
+    #ifdef USE_OMP
+    }
+    #endif
+
+    sl2cfoam_arena_release(arena, mark);
+
+    #ifdef USE_OMP
+    } // omp parallel
+    #endif
+
+}
+
+// number of abscissae processed at once in the factorized engine
+#define FACTORIZED_X_BLOCK 128
+
+// Computes the b4 matrix (up to the factors depending on (i, k))
+// contracting the 3j symbols with the dsmall functions at each abscissa
+// before integrating. For each q block with P(x, a) = d1 d2, Q(x, b) = d3 d4
+//
+//   A(ik, x) = sum_a U(a, ik) P(x, a)
+//   B(ik, x) = sum_b V(b, ik) Q(x, b)
+//
+// and the b4 contribution is sum_x w_x m_x Re(A(ik, x) B(ik, x)).
+// The error is estimated on each b4 entry from the difference between
+// Kronrod and Gauss weights and returned in b4_err. If b4_err_int is not
+// NULL the errors on each interval k of the grid are also returned
+// in its columns k dimik, ..., (k+1) dimik - 1.
+static void b4_factorized(sl2cfoam_b4_workspace* ws, sl2cfoam_dmatrix b4, sl2cfoam_dmatrix b4_err,
+                          sl2cfoam_dmatrix b4_err_int,
+                          dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4, b4_grid* g,
+                          sl2cfoam_cmatrix dp1, sl2cfoam_cmatrix dp2,
+                          sl2cfoam_cmatrix dp3, sl2cfoam_cmatrix dp4,
+                          int dimi, int dimk, int k12_offset, int k34_offset,
+                          tensor_ptr(boost_wig) wt_ip1p2, tensor_ptr(boost_wig) wt_ip3p4,
+                          tensor_ptr(boost_wig) wt_kp1p2, tensor_ptr(boost_wig) wt_kp3p4) {
+
+    int nxs = g->nxs;
+    int dimik = dimi * dimk;
+
+    double* wms = g->wms;
+    double* wdms = g->wdms;
+
+    dspin two_q_max = min(two_j1+two_j2, two_j3+two_j4);
+    int dimq = q_blocks(two_q_max);
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
+
+    size_t dima_max = min(DIM(two_j1), DIM(two_j2));
+    size_t dimb_max = min(DIM(two_j3), DIM(two_j4));
+
+    const int xb = FACTORIZED_X_BLOCK;
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    sl2cfoam_dmatrix b4_thread = arena_dmatrix(arena, dimi, dimk);
+    sl2cfoam_dmatrix b4_err_thread = arena_dmatrix(arena, dimi, dimk);
+    sl2cfoam_dmatrix b4_q = arena_dmatrix(arena, dimi, dimk);
+    sl2cfoam_dmatrix b4_err_q = arena_dmatrix(arena, dimi, dimk);
+
+    sl2cfoam_dmatrix b4_err_int_thread = NULL;
+    if (b4_err_int != NULL) b4_err_int_thread = arena_dmatrix(arena, dimik, g->intervals);
+    sl2cfoam_dmatrix U = arena_dmatrix(arena, dima_max, dimik);
+    sl2cfoam_dmatrix V = arena_dmatrix(arena, dimb_max, dimik);
+
+    // real and imaginary parts of P, Q for a block of abscissae (stacked along x)
+    sl2cfoam_dmatrix P = arena_dmatrix(arena, dima_max, 2 * xb);
+    sl2cfoam_dmatrix Q = arena_dmatrix(arena, dimb_max, 2 * xb);
+    sl2cfoam_dmatrix A = arena_dmatrix(arena, dimik, 2 * xb);
+    sl2cfoam_dmatrix B = arena_dmatrix(arena, dimik, 2 * xb);
+
+    #ifdef USE_OMP
+    #pragma omp for schedule(dynamic, 1)
+    #endif
+    for (int qi = 0; qi < dimq; qi++) {
+
+        dspin two_q = q_of_block(two_q_max, qi);
+
+        dspin two_p1_min, two_p1_max, two_p3_min, two_p3_max;
+        if (!q_block(two_q, two_j1, two_j2, two_j3, two_j4,
+                     &two_p1_min, &two_p1_max, &two_p3_min, &two_p3_max)) continue;
+
+        int dima = DIV2(two_p1_max - two_p1_min) + 1;
+        int dimb = DIV2(two_p3_max - two_p3_min) + 1;
+
+        fill_3j_products(U, V, two_q, two_j1, two_j2, two_j3, two_j4,
+                         two_p1_min, two_p1_max, two_p3_min, two_p3_max,
+                         dimi, dimk, k12_offset, k34_offset,
+                         wt_ip1p2, wt_ip3p4, wt_kp1p2, wt_kp3p4);
+
+        memset(b4_q, 0, dimik * sizeof(double));
+        memset(b4_err_q, 0, dimik * sizeof(double));
+
+        double factor_q = q_weight(two_q) * real_negpow(2 * two_q);
+
+        for (int x0 = 0; x0 < nxs; x0 += xb) {
+
+            int nx = min(xb, nxs - x0);
+
+            for (int xi = 0; xi < nx; xi++) {
+
+                for (dspin two_p1 = two_p1_min; two_p1 <= two_p1_max; two_p1 += 2) {
+
+                    int ai = DIV2(two_p1 - two_p1_min);
+
+                    double complex Pa = (matrix_column(dp1, nxs, DIV2(two_p1+two_j1)))[x0 + xi] *
+                                        (matrix_column(dp2, nxs, DIV2(two_q-two_p1+two_j2)))[x0 + xi];
+
+                    matrix_get(P, dima, ai, xi) = creal(Pa);
+                    matrix_get(P, dima, ai, (nx + xi)) = cimag(Pa);
+
+                }
+
+                for (dspin two_p3 = two_p3_min; two_p3 <= two_p3_max; two_p3 += 2) {
+
+                    int bi = DIV2(two_p3 - two_p3_min);
+
+                    double complex Qb = (matrix_column(dp3, nxs, DIV2(two_p3+two_j3)))[x0 + xi] *
+                                        (matrix_column(dp4, nxs, DIV2(-two_q-two_p3+two_j4)))[x0 + xi];
+
+                    matrix_get(Q, dimb, bi, xi) = creal(Qb);
+                    matrix_get(Q, dimb, bi, (nx + xi)) = cimag(Qb);
+
+                }
+
+            }
+
+            // A = U^T P, B = V^T Q
+            BLASW_DGEMM_TN(1.0, 0.0, dimik, 2 * nx, dima, U, dima, P, dima, A, dimik);
+            BLASW_DGEMM_TN(1.0, 0.0, dimik, 2 * nx, dimb, V, dimb, Q, dimb, B, dimik);
+
+            for (int xi = 0; xi < nx; xi++) {
+
+                double* Ar = matrix_column(A, dimik, xi);
+                double* Ai = matrix_column(A, dimik, (nx + xi));
+                double* Br = matrix_column(B, dimik, xi);
+                double* Bi = matrix_column(B, dimik, (nx + xi));
+
+                double wm = wms[x0 + xi];
+                double wdm = wdms[x0 + xi];
+
+                for (int iki = 0; iki < dimik; iki++) {
+
+                    double f = Ar[iki] * Br[iki] - Ai[iki] * Bi[iki];
+                    b4_q[iki] += wm * f;
+                    b4_err_q[iki] += wdm * f;
+
+                }
+
+                if (b4_err_int_thread != NULL) {
+
+                    double* e = matrix_column(b4_err_int_thread, dimik, ((x0 + xi) / g->points));
+                    double fwdm = factor_q * wdm;
+
+                    for (int iki = 0; iki < dimik; iki++) {
+                        e[iki] += fwdm * (Ar[iki] * Br[iki] - Ai[iki] * Bi[iki]);
+                    }
+
+                }
+
+            }
+
+        } // x blocks
+
+        for (int iki = 0; iki < dimik; iki++) {
+            b4_thread[iki] += factor_q * b4_q[iki];
+            b4_err_thread[iki] += factor_q * b4_err_q[iki];
+        }
+
+    } // q
+
+    // reduce over all threads
+    #ifdef USE_OMP
+    #pragma omp critical
+    {
+    #endif
+
+    for (int iki = 0; iki < dimik; iki++) {
+        b4[iki] += b4_thread[iki];
+        b4_err[iki] += b4_err_thread[iki];
+    }
+
+    if (b4_err_int != NULL) {
+        for (int k = 0; k < dimik * g->intervals; k++) {
+            b4_err_int[k] += b4_err_int_thread[k];
+        }
+    }
+
+    #ifdef USE_OMP
+    }
+    #endif
+
+    sl2cfoam_arena_release(arena, mark);
+
+    #ifdef USE_OMP
+    } // omp parallel
+    #endif
+
+}
+
+// Computes the b4 matrix for a single l-tuple given the dsmall matrices
+// of the 4 legs and the 3j tables. The tables for the k intertwiner
+// span the whole range allowed by the pairs (l1, l2) and (l3, l4).
+// If there is no parallelization above, here parallelize over the p indices
+// (good for simplified case with large spins).
+static void b4_tuple(sl2cfoam_b4_workspace* ws, sl2cfoam_dmatrix b4,
+                     dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                     dspin two_l1, dspin two_l2, dspin two_l3, dspin two_l4,
+                     b4_grid* g, sl2cfoam_cmatrix dp1, sl2cfoam_cmatrix dp2,
+                     sl2cfoam_cmatrix dp3, sl2cfoam_cmatrix dp4,
+                     tensor_ptr(boost_wig) wt_ip1p2, tensor_ptr(boost_wig) wt_ip3p4,
+                     tensor_ptr(boost_wig) wt_kp1p2, tensor_ptr(boost_wig) wt_kp3p4) {
+
+    dspin two_i_min = max(abs(two_j1-two_j2), abs(two_j3-two_j4));
+    dspin two_i_max = min(two_j1+two_j2, two_j3+two_j4);
+    dspin two_k_min = max(abs(two_l1-two_l2), abs(two_l3-two_l4));
+    dspin two_k_max = min(two_l1+two_l2, two_l3+two_l4);
+
+    int dimi = DIV2(two_i_max-two_i_min) + 1;
+    int dimk = DIV2(two_k_max-two_k_min) + 1;
+
+    // offsets of the k intertwiner in the 3j tables
+    int k12_offset = DIV2(two_k_min - abs(two_l1-two_l2));
+    int k34_offset = DIV2(two_k_min - abs(two_l3-two_l4));
+
+    bool factorized;
+    switch (B4_ENGINE)
+    {
+    case SL2CFOAM_B4_ENGINE_INTEGRATE:
+        factorized = false;
+        break;
+
+    case SL2CFOAM_B4_ENGINE_FACTORIZED:
+        factorized = true;
+        break;
+    
+    default:
+        factorized = factorized_cheaper(two_j1, two_j2, two_j3, two_j4,
+                                        dimi * dimk, g->nxs);
+    }
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    // the result is accumulated in the given matrix
+    memset(b4, 0, dimi * dimk * sizeof(double));
+
+    sl2cfoam_dmatrix b4_err = NULL;
+    sl2cfoam_dmatrix b4_err_int = NULL;
+
+    if (factorized) {
+
+        b4_err = arena_dmatrix(arena, dimi, dimk);
+        if (interval_errors(g)) b4_err_int = arena_dmatrix(arena, dimi * dimk, g->intervals);
+
+        b4_factorized(ws, b4, b4_err, b4_err_int, two_j1, two_j2, two_j3, two_j4,
+                      g, dp1, dp2, dp3, dp4,
+                      dimi, dimk, k12_offset, k34_offset,
+                      wt_ip1p2, wt_ip3p4, wt_kp1p2, wt_kp3p4);
+
+    } else {
+
+        // dsmall integrals
+        dsmall_integrals* di = dsmall_integrals_create(arena, two_j1, two_j2, two_j3, two_j4);
+
+        if (B4_INTEGRATION == SL2CFOAM_B4_INTEGRATION_GEMM) {
+            dsmall_integrals_gemm(ws, di, g, dp1, dp2, dp3, dp4);
+        } else {
+            dsmall_integrals_loop(ws, di, g, dp1, dp2, dp3, dp4);
+        }
+
+        b4_assemble(ws, b4, di, dimi, dimk, k12_offset, k34_offset,
+                    wt_ip1p2, wt_ip3p4, wt_kp1p2, wt_kp3p4);
+
+    }
+
+    // factors depending on (i, k)
+    // (the sign (-1)^(i + k + 2q) factorizes in (i, k) and q)
+    double b4_max = 0.0;
+    for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
+    for (dspin two_i = two_i_min; two_i <= two_i_max; two_i += 2) {
+
+        int ii = DIV2(two_i-two_i_min);
+        int ki = DIV2(two_k-two_k_min);
+
+        // check if boost is 0 by symmetries of the 3js
+        if (((two_j1 == two_j2 && two_l2 == two_l1) || (two_j3 == two_j4  && two_l4 == two_l3))
+            && (two_k - two_i) % 4 != 0) {
+
+            matrix_get(b4, dimi, ii, ki) = 0.0;
+            if (b4_err != NULL) matrix_get(b4_err, dimi, ii, ki) = 0.0;
+            if (b4_err_int != NULL) {
+                for (int k = 0; k < g->intervals; k++) {
+                    b4_err_int[ii + dimi * ki + dimi * dimk * k] = 0.0;
+                }
+            }
+            continue;
+
+        }
+
+        double factor = real_negpow(two_i + two_k) * sqrt(DIM(two_i) * DIM(two_k));
+
+        matrix_get(b4, dimi, ii, ki) *= factor;
+        b4_max = fmax(b4_max, fabs(matrix_get(b4, dimi, ii, ki)));
+
+        if (b4_err != NULL) matrix_get(b4_err, dimi, ii, ki) *= factor;
+        if (b4_err_int != NULL) {
+            for (int k = 0; k < g->intervals; k++) {
+                b4_err_int[ii + dimi * ki + dimi * dimk * k] *= factor;
+            }
+        }
+
+    } // i
+    } // k
+
+    // check the errors of the factorized engine
+    // (entries canceling to 0 are compared with the largest one)
+    if (b4_err != NULL && b4_max >= INTEGRAL_ZERO) {
+
+        int wcount = 0;
+        double gk_err = 0.0;
+        for (int ki = 0; ki < dimk; ki++) {
+        for (int ii = 0; ii < dimi; ii++) {
+
+            double res = matrix_get(b4, dimi, ii, ki);
+            double abserr = fabs(matrix_get(b4_err, dimi, ii, ki));
+            double ref = fmax(fabs(res), GK_TOL * b4_max);
+
+            gk_err = fmax(gk_err, relative_error(res, abserr, b4_max));
+
+            if (B4_TOLERANCE == 0 && abserr >= GK_TOL * ref) {
+
+                wcount++;
+                if (wcount <= WARN_MAX_PER_THREAD) {
+
+                    if (wcount < WARN_MAX_PER_THREAD) {
+                        warning("gk b4 (i, k) = (%d, %d) relative error = %.3g >= %.3g (b4 = %.3g)",
+                                two_i_min + 2*ii, two_k_min + 2*ki, abserr/ref, GK_TOL, res);
+                    } else {
+                        warning("gk b4 (i, k) = (%d, %d) relative error = %.3g >= %.3g (b4 = %.3g)\n"
+                                "(further warnings for this b4 not shown...)",
+                                two_i_min + 2*ii, two_k_min + 2*ki, abserr/ref, GK_TOL, res);
+                    }
+
+                }
+
+            }
+
+        } // i
+        } // k
+
+        workspace_gk_error(ws, gk_err);
+
+        if (b4_err_int != NULL) {
+
+            double* gk_errs = arena_array(arena, double, g->intervals);
+            for (int k = 0; k < g->intervals; k++) {
+                double* errs_k = matrix_column(b4_err_int, (dimi * dimk), k);
+                gk_errs[k] = block_error(b4, dimi, dimk, b4_max, errs_k, dimi);
+            }
+
+            grid_gk_errors(g, gk_errs);
+
+        }
+
+    }
+
+    sl2cfoam_arena_release(arena, mark);
+
+}
+
+// Returns the index of the spins pair (two_a, two_b) in the arrays,
+// appending it if not present.
+static inline size_t pair_index(dspin* two_as, dspin* two_bs, size_t* size, 
+                                dspin two_a, dspin two_b) {
+
+    for (size_t i = 0; i < *size; i++) {
+        if (two_as[i] == two_a && two_bs[i] == two_b) return i;
+    }
+
+    two_as[*size] = two_a;
+    two_bs[*size] = two_b;
+    return (*size)++;
+
+}
+
+// Builds the table of 3j symbols (la lb k; pa pb -pa-pb) for all allowed k
+// with indices (k, pa, pb). If reversed the 3j symbols are (k la lb; -pa-pb pa pb).
+// Must be called by all threads in a parallel region (with wigxjpf initialized).
+static void wig_table_k(tensor_ptr(boost_wig) wt, dspin two_ja, dspin two_jb,
+                        dspin two_la, dspin two_lb, bool reversed) {
+
+    dspin two_k_min = abs(two_la-two_lb);
+    dspin two_k_max = two_la+two_lb;
+
+    #ifdef USE_OMP
+    #pragma omp for collapse(3)
+    #endif
+    for (dspin two_pb = -two_jb; two_pb <= two_jb; two_pb += 2) {
+    for (dspin two_pa = -two_ja; two_pa <= two_ja; two_pa += 2) {
+    for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
+
+        int ki = DIV2(two_k-two_k_min);
 
-    spin j = SPIN(two_j);
-    spin l = SPIN(two_l);
-    double rho = RHO(j);
+        double w3j;
+        if (reversed) {
+            w3j = S3J(two_k, two_la, two_lb,
+                      -two_pa-two_pb, two_pa, two_pb);
+        } else {
+            w3j = S3J(two_la, two_lb, two_k,
+                      two_pa, two_pb, -two_pa-two_pb);
+        }
+        TENSOR_SET(w3j, wt, 3, ki, DIV2(two_pa+two_ja), DIV2(two_pb+two_jb));
 
-    // compute Speziale's phase
-    __complex128 sph;
+    } // k
+    } // pa
+    } // pb
 
-    mpc_t z1, z2;
-    mpfr_t gabs;
-    mpc_init2(z1, MPBITS);
-    mpc_init2(z2, MPBITS);
-    mpfr_init2(gabs, MPBITS);
+}
 
-    mpc_set_d_d(z1, j + 1.0, rho, MPC_RNDNN);
-    sl2cfoam_complex_gamma(z2, z1, lanczos);
+// Returns a tensor for 3j symbols with memory from the arena.
+static tensor_ptr(boost_wig) arena_wig_tensor(b4_arena* arena, size_t dim0, size_t dim1, size_t dim2) {
 
-    mpc_abs(gabs, z2, MPFR_RNDN);
-    mpc_div_fr(z2, z2, gabs, MPC_RNDNN);
+    tensor_ptr(boost_wig) t = arena_array(arena, tensor_t(boost_wig), 1);
 
-    mpc_set_d_d(z1, l + 1.0, -rho, MPC_RNDNN);
-    sl2cfoam_complex_gamma(z1, z1, lanczos);
+    t->num_keys = 3;
+    t->dims[0] = dim0;
+    t->dims[1] = dim1;
+    t->dims[2] = dim2;
+    t->strides[0] = 1;
+    t->strides[1] = (ptrdiff_t)dim0;
+    t->strides[2] = (ptrdiff_t)(dim0 * dim1);
+    t->dim = dim0 * dim1 * dim2;
+    t->d = arena_dmatrix(arena, t->dim, 1);
+    t->tag = NULL;
 
-    mpc_abs(gabs, z1, MPFR_RNDN);
-    mpc_div_fr(z1, z1, gabs, MPC_RNDNN);
+    return t;
 
-    mpc_mul(z2, z2, z1, MPC_RNDNN);
+}
 
-    sph = mpfr_get_float128(z2->re, MPFR_RNDN) + I * mpfr_get_float128(z2->im, MPFR_RNDN);
-    sph *= complex_negpow(DIV2(two_l-two_j));
+// Computes the dsmall matrices ds[ds_todo[ti]] with spins (j, l)
+// given in ds_two_j, ds_two_l at the abscissae qxs of the grid g
+// (all or some of them). The indices in ds_todo are sorted by (j, l).
+static void dsmall_compute(sl2cfoam_b4_workspace* ws, sl2cfoam_cmatrix* ds,
+                           dspin* ds_two_j, dspin* ds_two_l, size_t* ds_todo, size_t ds_todo_size,
+                           __float128* qxs, int nxs, b4_grid* g) {
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    __float128 dx_min = g->dx_min;
+    int accuracy = dsmall_accuracy(g);
+
+
+    // sort the matrices to compute by (j, l) so that the shells
+    // with the same j are computed together as a ladder in l
+    for (size_t ti = 1; ti < ds_todo_size; ti++) {
+        size_t dt = ds_todo[ti];
+        size_t tj = ti;
+        while (tj > 0 && (ds_two_j[ds_todo[tj-1]] > ds_two_j[dt] ||
+                         (ds_two_j[ds_todo[tj-1]] == ds_two_j[dt] && ds_two_l[ds_todo[tj-1]] > ds_two_l[dt]))) {
+            ds_todo[tj] = ds_todo[tj-1];
+            tj--;
+        }
+        ds_todo[tj] = dt;
+    }
 
-    mpc_clear(z1);
-    mpc_clear(z2);
-    mpfr_clear(gabs);
+    // split the ladders so that there are enough of them for all threads
+    int threads = 1;
+    #ifdef USE_OMP
+    if (OMP_PARALLELIZE) threads = omp_get_max_threads();
+    #endif
 
-    return sph;
-        
-}
+    size_t ladder_max = (ds_todo_size + threads - 1) / threads;
 
-static inline void dsmall_prefactors(mpc_ptr* rop, __float128* xs, int nxs, int precision,
-                                     dspin two_j, dspin two_l, double rho) {
+    size_t* ladders = arena_array(arena, size_t, ds_todo_size + 1);
+    size_t ladders_num = 0;
 
-    mpc_t emi_r_rho_ab;
-    mpc_t pref;
+    for (size_t ti = 0; ti < ds_todo_size; ti++) {
+        if (ti == 0 || ds_two_j[ds_todo[ti]] != ds_two_j[ds_todo[ti-1]] ||
+            ti - ladders[ladders_num-1] == ladder_max) {
+            ladders[ladders_num++] = ti;
+        }
+    }
+    ladders[ladders_num] = ds_todo_size;
 
-    mpfr_t emr_ab;
-    mpfr_t mr_rho_ab;
+    sl2cfoam_cmatrix* ladder_ds = arena_array(arena, sl2cfoam_cmatrix, ds_todo_size);
+    dspin* ladder_two_l = arena_array(arena, dspin, ds_todo_size);
 
-    mpc_init2(emi_r_rho_ab, precision);
-    mpc_init2(pref, precision);
+    for (size_t ti = 0; ti < ds_todo_size; ti++) {
+        ladder_ds[ti] = ds[ds_todo[ti]];
+        ladder_two_l[ti] = ds_two_l[ds_todo[ti]];
+    }
 
-    mpfr_init2(emr_ab, precision);
-    mpfr_init2(mr_rho_ab, precision);
+    // powers of the abscissae for all the ladders
+    // (read by all threads, borrowed from the pool of this one)
+    mp_pool_mark mp_mark = sl2cfoam_mp_mark();
 
-    for (int i = 0; i < nxs; i++) {
+    dsmall_powers pows = { 0, NULL, NULL };
+    int prec_max = 0;
 
-        // exp(-r)
-        mpfr_set_float128(emr_ab, xs[i], MPFR_RNDN);
+    for (size_t ti = 0; ti < ds_todo_size; ti++) {
 
-        // get exp(-i*r*rho)
-        mpfr_log(mr_rho_ab, emr_ab, MPFR_RNDN);
-        mpfr_mul_d(mr_rho_ab, mr_rho_ab, rho, MPFR_RNDN);
-        mpfr_sin_cos(emi_r_rho_ab->im, emi_r_rho_ab->re, mr_rho_ab, MPFR_RNDN);
+        dspin two_ji = ds_two_j[ds_todo[ti]];
+        dspin two_li = ds_two_l[ds_todo[ti]];
 
-        // prefactor
-        mpfr_sqr(pref->re, emr_ab, MPFR_RNDN);
-        mpfr_set_ui(pref->im, 0, MPFR_RNDN);
-        mpfr_ui_sub(pref->re, 1, pref->re, MPFR_RNDN);
-        mpfr_pow_si(pref->re, pref->re, -DIV2(two_j+two_l) - 1, MPFR_RNDN);
+        pows.e_max = max(pows.e_max, 2 + two_ji + two_li);
 
-        mpc_mul(rop[i], pref, emi_r_rho_ab, MPC_RNDNN);
+        int prec = dsmall_precision(two_ji, two_li, dx_min);
+        if (prec > FLT128_MANT_DIG && prec > prec_max) prec_max = prec;
 
     }
 
-    mpc_clear(emi_r_rho_ab);
-    mpc_clear(pref);
+    pows.q = arena_array(arena, __float128*, nxs);
+    for (int i = 0; i < nxs; i++) {
+        pows.q[i] = arena_array(arena, __float128, pows.e_max + 1);
+    }
+    sl2cfoam_dsmall_powers_q(pows.q, qxs, nxs, pows.e_max);
 
-    mpfr_clear(mr_rho_ab);
-    mpfr_clear(emr_ab);
+    if (prec_max > 0) {
 
-}
+        pows.mp = arena_array(arena, mpfr_ptr*, nxs);
+        for (int i = 0; i < nxs; i++) {
+            pows.mp[i] = arena_array(arena, mpfr_ptr, pows.e_max + 1);
+        }
+        sl2cfoam_dsmall_powers(pows.mp, qxs, nxs, pows.e_max, prec_max);
 
-// If there is no parallelization above, here parallelize over the p indices
-// (good for simplified case with large spins).
-sl2cfoam_dmatrix sl2cfoam_b4(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
-                             dspin two_l1, dspin two_l2, dspin two_l3, dspin two_l4) {
+    }
 
-    dspin two_jis[4] = { two_j1, two_j2, two_j3, two_j4 };
-    dspin two_lis[4] = { two_l1, two_l2, two_l3, two_l4 };
+    #ifdef USE_OMP
+    // parallelize here only if there are enough ladders
+    // otherwise parallelize over the p indices inside
+    bool go_parallel = (ladders_num >= 4);
+    #pragma omp parallel for schedule(dynamic, 1) if(OMP_PARALLELIZE && go_parallel)
+    #endif
+    for (size_t li = 0; li < ladders_num; li++) {
 
-    size_t dimp1 = DIM(two_j1);
-    size_t dimp2 = DIM(two_j2);
-    size_t dimp3 = DIM(two_j3);
-    size_t dimp4 = DIM(two_j4);
+        size_t start = ladders[li];
+        int nl = (int)(ladders[li+1] - start);
 
-    // fix global grid
+        dspin two_ji = ds_two_j[ds_todo[start]];
 
-    dspin two_l_max = max4(two_l1, two_l2, two_l3, two_l4);
-    
-    // set the number of intervals for integration
-    // (next variable looks ok even as low as 1 for most cases...)
+        dsmall_matrices(ws, &ladder_ds[start], two_ji, &ladder_two_l[start], nl,
+                        qxs, nxs, dx_min, &pows, accuracy);
 
-    double interval_mult;
+    }
 
-    switch (ACCURACY)
-    {
-    case SL2CFOAM_ACCURACY_NORMAL:
-        interval_mult = 1.5;
-        break;
+    sl2cfoam_mp_release(mp_mark);
 
-    case SL2CFOAM_ACCURACY_HIGH:
-        interval_mult = 2.5;
-        break;
 
-    case SL2CFOAM_ACCURACY_VERYHIGH:
-        interval_mult = 4.0;
-        break;
-    
-    default:
-        error("wrong accuracy value");
+    sl2cfoam_arena_release(arena, mark);
+
+}
+
+// Computes the dsmall matrices ds_new on the grid g_new reusing the
+// values of the matrices ds (nxs rows) on another grid: the row i of
+// ds_new is copied from the row src[i] of ds, or computed if src[i] < 0.
+static void dsmall_extend(sl2cfoam_b4_workspace* ws, sl2cfoam_cmatrix* ds_new,
+                          sl2cfoam_cmatrix* ds, int nxs, int* src,
+                          dspin* ds_two_j, dspin* ds_two_l, size_t ds_size, b4_grid* g_new) {
+
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    int nxs_new = g_new->nxs;
+
+    // rows of the new grid to compute
+    int* rows = arena_array(arena, int, nxs_new);
+    int nrows = 0;
+
+    for (int i = 0; i < nxs_new; i++) {
+        if (src[i] < 0) rows[nrows++] = i;
     }
 
-    // TODO: better study of this criterion
-    //       maybe no less than 2 intervals (~120 points) to begin with?
-    double glmax = SPIN(two_l_max) * fmax(1.0, sqrt(IMMIRZI));
-    int intervals = max(1, floor(interval_mult * sqrt(glmax)));
-    int nxs = GK_POINTS * intervals;
+    for (size_t di = 0; di < ds_size; di++) {
+        for (int pi = 0; pi < DIM(ds_two_j[di]); pi++) {
 
-    __float128* grid = sl2cfoam_grid_harmonic(intervals);
-    __float128* qxs = sl2cfoam_gk_grid_abscissae(intervals, grid);
-    __float128 dx_min = qxs[1];
+            sl2cfoam_cvector d = matrix_column(ds_new[di], nxs_new, pi);
+            sl2cfoam_cvector d_old = matrix_column(ds[di], nxs, pi);
 
-    double xs[nxs];
-    for (int i = 0; i < nxs; i++) {
-        xs[i] = (double)qxs[i];
+            for (int i = 0; i < nxs_new; i++) {
+                if (src[i] >= 0) d[i] = d_old[src[i]];
+            }
+
+        }
     }
 
-    // relative error threshold in integration for prompting a warning
-    const double gk_tol = 0.01;
+    if (nrows > 0) {
+
+        __float128* qxs = arena_array(arena, __float128, nrows);
+        for (int r = 0; r < nrows; r++) {
+            qxs[r] = g_new->qxs[rows[r]];
+        }
+
+        sl2cfoam_cmatrix* ds_rows = arena_array(arena, sl2cfoam_cmatrix, ds_size);
+        size_t* ds_todo = arena_array(arena, size_t, ds_size);
 
-    // the dsmall integral can be exactly zero by certain symmetries
-    // so if we find that the error is large and the value is very small
-    // then it is probably just numerical noise
-    const double integral_zero = 1e-16;
+        for (size_t di = 0; di < ds_size; di++) {
+            ds_rows[di] = arena_cmatrix(arena, nrows, DIM(ds_two_j[di]));
+            ds_todo[di] = di;
+        }
 
-    // compute measure
-    double measure[nxs];
-    dsmall_measure(measure, xs, nxs);
+        dsmall_compute(ws, ds_rows, ds_two_j, ds_two_l, ds_todo, ds_size, qxs, nrows, g_new);
 
-    // compute weights
-    double* wgks = sl2cfoam_gk_grid_weights(intervals, grid);
-    double* wgs = sl2cfoam_gk_grid_weights_gauss(intervals, grid);
+        for (size_t di = 0; di < ds_size; di++) {
+            for (int pi = 0; pi < DIM(ds_two_j[di]); pi++) {
 
-    // arrays with dsmall values for each p and r
-    sl2cfoam_cmatrix dp1 = cmatrix_alloc(nxs, dimp1);
-    sl2cfoam_cmatrix dp2 = cmatrix_alloc(nxs, dimp2);
-    sl2cfoam_cmatrix dp3 = cmatrix_alloc(nxs, dimp3);
-    sl2cfoam_cmatrix dp4 = cmatrix_alloc(nxs, dimp4);
+                sl2cfoam_cvector d = matrix_column(ds_new[di], nxs_new, pi);
+                sl2cfoam_cvector d_rows = matrix_column(ds_rows[di], nrows, pi);
 
-    sl2cfoam_cmatrix dpall[4] = { dp1, dp2, dp3, dp4 };
+                for (int r = 0; r < nrows; r++) {
+                    d[rows[r]] = d_rows[r];
+                }
 
-    cgamma_lanczos lanczos;
-    sl2cfoam_cgamma_lanczos_fill(&lanczos);
+            }
+        }
 
-    dspin two_ji, two_li;
-    for (int dsmall_index = 0; dsmall_index < 4; dsmall_index++) {
+    }
 
-        two_ji = two_jis[dsmall_index];
-        two_li = two_lis[dsmall_index];
+    sl2cfoam_arena_release(arena, mark);
 
-        spin ji = SPIN(two_ji);
-        double rho = RHO(ji);
+}
 
-        // fix precision for this dsmall
-        int prec_base, prec_add;
+// Sets the rows src of the grid obtained by bisecting the intervals
+// of the grid g with bisect[k] set (see dsmall_extend): the intervals
+// kept are copied, the new ones are computed.
+static void rows_bisect(int* src, b4_grid* g, bool* bisect) {
 
-        // there should be enough significant digits to cancel the prefactor 
-        // (1-(1-dx)^2)^-(j1+j2+1) ~ (2*dx)^-(j1+j2+1) ...
-        prec_add = - (int)((DIV2(two_ji+two_li)+1) * log2q(2 * dx_min));
+    int i = 0;
+    for (int k = 0; k < g->intervals; k++) {
 
-        // and some more of course
-        // base precision is found by "trial and error"
-        if (two_li <= 50) {
-            prec_base = 64;
-        } else if (two_li <= 100) {
-            prec_base = 128;
+        if (bisect[k]) {
+            for (int p = 0; p < 2 * g->points; p++) src[i++] = -1;
         } else {
-            prec_base = 256;
+            for (int p = 0; p < g->points; p++) src[i++] = k * g->points + p;
         }
 
-        // total precision;
-        int precision = prec_base + prec_add;
+    }
+
+}
+
+// Sets the rows src of the nested grid g_new from a grid with the same
+// intervals and a lower level, with given points per interval
+// (see dsmall_extend): these are the first points of each interval.
+static void rows_nested(int* src, b4_grid* g_new, int points) {
 
-        // precompute expensive prefactors
-        mpc_ptr prefactors[nxs];
-        for (int i = 0; i < nxs; i++) {
-            prefactors[i] = (mpc_ptr)malloc(sizeof(mpc_t));
-            mpc_init2(prefactors[i], precision);
+    for (int k = 0; k < g_new->intervals; k++) {
+        for (int p = 0; p < g_new->points; p++) {
+            src[k * g_new->points + p] = (p < points ? k * points + p : -1);
         }
+    }
 
-        dsmall_prefactors(prefactors, qxs, nxs, precision, two_ji, two_li, rho);
-        
-        // compute Speziale's phase
-        __complex128 sph = dsmall_phase(two_ji, two_li, &lanczos);
-        int mph = real_negpow(two_ji-two_li);
+}
 
-        sl2cfoam_cmatrix dpi = dpall[dsmall_index];
+// Sets the dsmall matrices ds with spins (j, l) given in ds_two_j, ds_two_l
+// on the grid g. The matrices depend only on (j, l) and the grid so they
+// are looked for in the cache before computing. For a nested grid the
+// values at the abscissae of a lower level are taken from the matrices
+// ds_prev on the grid g_prev if given, otherwise from the cache, and
+// only the new abscissae are computed.
+static void dsmall_grid(sl2cfoam_b4_workspace* ws, sl2cfoam_cmatrix* ds,
+                        dspin* ds_two_j, dspin* ds_two_l, size_t ds_size, b4_grid* g,
+                        sl2cfoam_cmatrix* ds_prev, b4_grid* g_prev) {
 
-        #ifdef USE_OMP
-        #pragma omp parallel for if(OMP_PARALLELIZE)
-        #endif
-        for (dspin two_p = is_integer(two_ji) ? 0 : 1; two_p <= two_ji; two_p += 2) {
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
 
-            sl2cfoam_cvector dpip;
-            sl2cfoam_cvector dpipm;
-        
-            __complex128 ds[nxs];
+    int nxs = g->nxs;
+    int accuracy = dsmall_accuracy(g);
 
-            // compute the Y coefficients
-            int Jmp = DIV2(abs(two_ji - two_p)); // |J-p|
-            int Jpp = DIV2(abs(two_ji + two_p)); // |J+p|
-            int m_max = DIV2(two_ji + two_li) - Jmp;
-            int n_max = DIV2(two_ji + two_li) - Jpp;
+    size_t* ds_todo = arena_array(arena, size_t, ds_size);
+    size_t ds_todo_size = 0;
 
-            mpc_ptr Ym[m_max+1];
-            mpc_ptr Yn[n_max+1];
+    for (size_t di = 0; di < ds_size; di++) {
 
-            for (int m = 0; m <= m_max; m++) {
-                Ym[m] = (mpc_ptr)malloc(sizeof(mpc_t));
-                mpc_init2(Ym[m], precision);
-            }
+        dspin two_ji = ds_two_j[di];
+        double rho = RHO(SPIN(two_ji));
 
-            for (int n = 0; n <= n_max; n++) {
-                Yn[n] = (mpc_ptr)malloc(sizeof(mpc_t));
-                mpc_init2(Yn[n], precision);
-            }
+        if (!sl2cfoam_dsmall_cache_get(ds[di], two_ji, ds_two_l[di], rho, nxs, g->hash, accuracy)) {
+            ds_todo[ds_todo_size++] = di;
+        }
 
-            // the following functions should not be parallelized if called
-            // from booster tensor loop since nested parallelization is
-            // disabled at initialization
+    }
 
-            // compute Y coefficients
-            sl2cfoam_dsmall_Yc(Ym, precision,  rho, two_ji, two_li, two_ji,  two_p);
-            sl2cfoam_dsmall_Yc(Yn, precision, -rho, two_ji, two_ji, two_li, -two_p);
+    // matrices computed here to put in the cache
+    size_t* ds_put = arena_array(arena, size_t, ds_size);
+    size_t ds_put_size = 0;
 
-            // compute dsmall at all points
-            sl2cfoam_dsmall(ds, qxs, nxs, precision, Ym, Yn, prefactors, 
-                            rho, two_ji, two_ji, two_li, two_p);
+    if (g->level > NESTED_LEVEL_MIN && ds_todo_size > 0) {
 
-            // multiply phase for p and set
-            dpip = matrix_column(dpi, nxs, DIV2(two_p+two_ji));
-            for (int i = 0; i < nxs; i++) {
-                dpip[i] = (double complex)(ds[i] * sph);
-            }
+        // matrices found on a lower level
+        sl2cfoam_cmatrix* ds_ext = arena_array(arena, sl2cfoam_cmatrix, ds_todo_size);
+        sl2cfoam_cmatrix* ds_low = arena_array(arena, sl2cfoam_cmatrix, ds_todo_size);
+        dspin* ext_two_j = arena_array(arena, dspin, ds_todo_size);
+        dspin* ext_two_l = arena_array(arena, dspin, ds_todo_size);
+        int* src = arena_array(arena, int, nxs);
 
-            // set the values for -p
-            dpipm = matrix_column(dpi, nxs, DIV2(-two_p+two_ji));
-            for (int i = 0; i < nxs; i++) {
-                dpipm[i] = (double complex)(mph * conjq(dpip[i]));
-            }
+        for (int level = g->level - 1; level >= NESTED_LEVEL_MIN && ds_todo_size > 0; level--) {
 
-            // clear the Y coefficients
-            for (int m = 0; m <= m_max; m++) {
-                mpc_clear(Ym[m]);
-                free(Ym[m]);
-            }
+            if (g_prev != NULL && g_prev->level != level) continue;
+            b4_grid* g_low = (g_prev != NULL ? g_prev : workspace_grid(ws, g->intervals, NESTED_POINTS(level), level));
 
-            for (int n = 0; n <= n_max; n++) {
-                mpc_clear(Yn[n]);
-                free(Yn[n]);
-            }
+            size_t ext_size = 0;
+            size_t left = 0;
 
-        } // p
+            for (size_t ti = 0; ti < ds_todo_size; ti++) {
 
-        // clear prefactors
-        for (int i = 0; i < nxs; i++) {
-            mpc_clear(prefactors[i]);
-            free(prefactors[i]);
-        }
+                size_t di = ds_todo[ti];
+                dspin two_ji = ds_two_j[di];
+                double rho = RHO(SPIN(two_ji));
 
-    } // loop over 4 dsmalls
+                bool found;
+                if (ds_prev != NULL) {
+                    ds_low[ext_size] = ds_prev[di];
+                    found = true;
+                } else {
+                    ds_low[ext_size] = arena_cmatrix(arena, g_low->nxs, DIM(two_ji));
+                    found = sl2cfoam_dsmall_cache_get(ds_low[ext_size], two_ji, ds_two_l[di], rho,
+                                                      g_low->nxs, g_low->hash, accuracy);
+                }
 
-    sl2cfoam_cgamma_lanczos_free(&lanczos);
+                if (found) {
+                    ds_ext[ext_size] = ds[di];
+                    ext_two_j[ext_size] = two_ji;
+                    ext_two_l[ext_size] = ds_two_l[di];
+                    ext_size++;
+                    ds_put[ds_put_size++] = di;
+                } else {
+                    ds_todo[left++] = di;
+                }
 
-    // tensor for dsmall integrals
-    tensor_ptr(dsmall_integral) dtens;
-    TENSOR_CREATE(dsmall_integral, dtens, 4, dimp1, dimp2, dimp3, dimp4);
+            }
 
-    int wcount = 0;
-    const int warn_max_per_thread = 10;
+            ds_todo_size = left;
 
-    #ifdef USE_OMP
-    #pragma omp parallel for collapse(3) private(wcount) if(OMP_PARALLELIZE)
-    #endif
-    for (dspin two_p4 = -two_j4; two_p4 <= two_j4; two_p4 += 2) {
-    for (dspin two_p3 = -two_j3; two_p3 <= two_j3; two_p3 += 2) {
-    for (dspin two_p2 = -two_j2; two_p2 <= two_j2; two_p2 += 2) {
+            if (ext_size > 0) {
+
+                verb(SL2CFOAM_VERBOSE_HIGH, "dsmall: extending %zu matrices from level %d to %d\n",
+                     ext_size, level, g->level);
+
+                rows_nested(src, g, g_low->points);
+                dsmall_extend(ws, ds_ext, ds_low, g_low->nxs, src, ext_two_j, ext_two_l, ext_size, g);
+
+            }
 
-        dspin two_p1 = - two_p4 - two_p3 - two_p2;
-        if (two_p1 < -two_j1 || two_p1 > two_j1) {
-            continue;
         }
 
-        int p1i, p2i, p3i, p4i;
-        p1i = DIV2(two_p1+two_j1);
-        p2i = DIV2(two_p2+two_j2);
-        p3i = DIV2(two_p3+two_j3);
-        p4i = DIV2(two_p4+two_j4);
+    }
 
-        // multiply and then take real part
-        double prod[nxs];
-        double complex cprod;
-        for (int i = 0; i < nxs; i++) {
+    if (ds_todo_size > 0) {
 
-            cprod = (matrix_column(dp1, nxs, p1i))[i] * 
-                    (matrix_column(dp2, nxs, p2i))[i] *
-                    (matrix_column(dp3, nxs, p3i))[i] *
-                    (matrix_column(dp4, nxs, p4i))[i];
-            prod[i] = creal(cprod);
+        dsmall_compute(ws, ds, ds_two_j, ds_two_l, ds_todo, ds_todo_size, g->qxs, nxs, g);
 
+        for (size_t ti = 0; ti < ds_todo_size; ti++) {
+            ds_put[ds_put_size++] = ds_todo[ti];
         }
 
-        double res, abserr, absres;
+    }
 
-        res = sl2cfoam_gk_grid(intervals, prod, measure, wgks, wgs, &abserr);
+    for (size_t pi = 0; pi < ds_put_size; pi++) {
 
-        absres = fabs(res);
-        if (abserr >= gk_tol * absres) {
+        size_t di = ds_put[pi];
+        dspin two_ji = ds_two_j[di];
+        double rho = RHO(SPIN(two_ji));
 
-            if (absres < integral_zero) {
+        sl2cfoam_dsmall_cache_put(ds[di], two_ji, ds_two_l[di], rho, nxs, g->hash, accuracy);
 
-                // this is numerical noise
-                // do not bother and leave the integral to 0 exactly
-                continue;
+    }
 
-            }
+    sl2cfoam_arena_release(arena, mark);
 
-            wcount++;
-            if (wcount <= warn_max_per_thread) {
+}
 
-                // probably worth a warning
-                if (wcount < warn_max_per_thread) {
-                    warning("gk integral (pi) = (%d, %d, %d, %d) relative error = %.3g >= %.3g (integral = %.3g)",
-                        two_p1, two_p2, two_p3, two_p4, abserr/absres, gk_tol, res);
-                } else {
-                    warning("gk integral (pi) = (%d, %d, %d, %d) relative error = %.3g >= %.3g (integral = %.3g)\n"
-                            "(further warnings for integration on this thread not shown...)",
-                            two_p1, two_p2, two_p3, two_p4, abserr/absres, gk_tol, res);
-                }
-                
-            }
-            
-        }
+// largest refinement of the grid for the highest accuracy
+// for meeting the tolerance
+#define INTERVALS_REFINE_MAX 8
 
-        // set real part (should be) in dsmall tensor
-        TENSOR_SET(res, dtens, 4, p1i, p2i, p3i, p4i);
+void sl2cfoam_b4_batch_grid(sl2cfoam_b4_workspace* ws,
+                            dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                            size_t n, dspin* two_ls, sl2cfoam_dmatrix* outs,
+                            int intervals, int points) {
 
-    } // p2
-    } // p3
-    } // p4
+    dspin two_jis[4] = { two_j1, two_j2, two_j3, two_j4 };
 
-    // compute 4jm tensors
+    size_t dimp1 = DIM(two_j1);
+    size_t dimp2 = DIM(two_j2);
+    size_t dimp3 = DIM(two_j3);
+    size_t dimp4 = DIM(two_j4);
 
     dspin two_i_min = max(abs(two_j1-two_j2), abs(two_j3-two_j4));
     dspin two_i_max = min(two_j1+two_j2, two_j3+two_j4);
-    dspin two_k_min = max(abs(two_l1-two_l2), abs(two_l3-two_l4));
-    dspin two_k_max = min(two_l1+two_l2, two_l3+two_l4);
 
     int dimi = DIV2(two_i_max-two_i_min) + 1;
-    int dimk = DIV2(two_k_max-two_k_min) + 1;
 
-    // tensors for wigner symbols
-    tensor_ptr(boost_wig) wt_ip1p2;
-    tensor_ptr(boost_wig) wt_ip3p4;
-    tensor_ptr(boost_wig) wt_kp1p2;
-    tensor_ptr(boost_wig) wt_kp3p4;
-    TENSOR_CREATE(boost_wig, wt_ip1p2, 3, dimi, dimp1, dimp2);
-    TENSOR_CREATE(boost_wig, wt_ip3p4, 3, dimi, dimp3, dimp4);
-    TENSOR_CREATE(boost_wig, wt_kp1p2, 3, dimk, dimp1, dimp2);
-    TENSOR_CREATE(boost_wig, wt_kp3p4, 3, dimk, dimp3, dimp4);
+    sl2cfoam_b4_workspace_enter(ws);
 
-    // final b4 matrix in indices (i, k)
-    sl2cfoam_dmatrix b4 = dmatrix_alloc(dimi, dimk);
+    b4_arena* arena = sl2cfoam_b4_workspace_arena(ws);
+    b4_arena_mark mark = sl2cfoam_arena_mark(arena);
+
+    // global grid with given number of intervals
+    // (the points are fixed by the level for the nested rule)
+    int level = (B4_QUADRATURE == SL2CFOAM_B4_QUADRATURE_NESTED ? nested_level() : -1);
+    if (level >= 0) points = NESTED_POINTS(level);
+
+    b4_grid* g = workspace_grid(ws, intervals, points, level);
+
+    int nxs = g->nxs;
+
+    //////////////////////////////////////////////////////////////////////
+    // collect the distinct spins (j, l) over all legs and tuples
+    // each dsmall matrix is computed only once for all the tuples
+    //////////////////////////////////////////////////////////////////////
+
+    dspin* ds_two_j = arena_array(arena, dspin, 4 * n);
+    dspin* ds_two_l = arena_array(arena, dspin, 4 * n);
+    size_t ds_size = 0;
+
+    // index of the dsmall matrix for each leg of each tuple
+    size_t* tuple_ds = arena_array(arena, size_t, 4 * n);
+
+    // pairs (l1, l2) and (l3, l4) for the 3j tables of the k intertwiner
+    dspin* k12_two_l1 = arena_array(arena, dspin, n);
+    dspin* k12_two_l2 = arena_array(arena, dspin, n);
+    dspin* k34_two_l3 = arena_array(arena, dspin, n);
+    dspin* k34_two_l4 = arena_array(arena, dspin, n);
+    size_t k12_size = 0;
+    size_t k34_size = 0;
+
+    // index of the 3j tables for each tuple
+    size_t* tuple_k12 = arena_array(arena, size_t, n);
+    size_t* tuple_k34 = arena_array(arena, size_t, n);
+
+    // tuples with allowed intertwiners k
+    bool* tuple_todo = arena_array(arena, bool, n);
+
+    // largest spin l of the tuples
+    dspin two_l_max = 0;
+
+    for (size_t t = 0; t < n; t++) {
+
+        dspin* ls = &two_ls[4*t];
+
+        tuple_todo[t] = min(ls[0]+ls[1], ls[2]+ls[3]) >= max(abs(ls[0]-ls[1]), abs(ls[2]-ls[3]));
+        if (!tuple_todo[t]) continue;
+
+        two_l_max = max(two_l_max, max4(ls[0], ls[1], ls[2], ls[3]));
+
+        for (int a = 0; a < 4; a++) {
+            tuple_ds[4*t + a] = pair_index(ds_two_j, ds_two_l, &ds_size, two_jis[a], ls[a]);
+        }
+
+        tuple_k12[t] = pair_index(k12_two_l1, k12_two_l2, &k12_size, ls[0], ls[1]);
+        tuple_k34[t] = pair_index(k34_two_l3, k34_two_l4, &k34_size, ls[2], ls[3]);
+
+    }
+
+    sl2cfoam_cmatrix* ds = arena_array(arena, sl2cfoam_cmatrix, ds_size);
+    for (size_t di = 0; di < ds_size; di++) {
+        ds[di] = arena_cmatrix(arena, nxs, DIM(ds_two_j[di]));
+    }
+
+    dsmall_grid(ws, ds, ds_two_j, ds_two_l, ds_size, g, NULL, NULL);
+
+    // tensors for wigner symbols of the i intertwiner
+    // these depend only on the spins j and are shared by all tuples
+    tensor_ptr(boost_wig) wt_ip1p2 = arena_wig_tensor(arena, dimi, dimp1, dimp2);
+    tensor_ptr(boost_wig) wt_ip3p4 = arena_wig_tensor(arena, dimi, dimp3, dimp4);
+
+    // tensors for wigner symbols of the k intertwiner
+    // one for each pair (l1, l2) and (l3, l4), shared by all tuples with that pair
+    tensor_ptr(boost_wig)* wt_kp1p2 = arena_array(arena, tensor_ptr(boost_wig), k12_size);
+    tensor_ptr(boost_wig)* wt_kp3p4 = arena_array(arena, tensor_ptr(boost_wig), k34_size);
+
+    for (size_t ki = 0; ki < k12_size; ki++) {
+        size_t dimk = min(k12_two_l1[ki], k12_two_l2[ki]) + 1;
+        wt_kp1p2[ki] = arena_wig_tensor(arena, dimk, dimp1, dimp2);
+    }
+
+    for (size_t ki = 0; ki < k34_size; ki++) {
+        size_t dimk = min(k34_two_l3[ki], k34_two_l4[ki]) + 1;
+        wt_kp3p4[ki] = arena_wig_tensor(arena, dimk, dimp3, dimp4);
+    }
 
     #ifdef USE_OMP
     #pragma omp parallel if(OMP_PARALLELIZE)
@@ -487,147 +2445,143 @@ sl2cfoam_dmatrix sl2cfoam_b4(dspin two_j1, dspin two_j2, dspin two_j3, dspin two
     } // p3
     } // p4
 
+    for (size_t ki = 0; ki < k12_size; ki++) {
+        wig_table_k(wt_kp1p2[ki], two_j1, two_j2, k12_two_l1[ki], k12_two_l2[ki], false);
+    }
+
+    for (size_t ki = 0; ki < k34_size; ki++) {
+        wig_table_k(wt_kp3p4[ki], two_j3, two_j4, k34_two_l3[ki], k34_two_l4[ki], true);
+    }
+
+    wig_temp_free();
+
     #ifdef USE_OMP
-    #pragma omp for collapse(3)
+    } // omp parallel
     #endif
-    for (dspin two_p2 = -two_j2; two_p2 <= two_j2; two_p2 += 2) {   
-    for (dspin two_p1 = -two_j1; two_p1 <= two_j1; two_p1 += 2) {
-    for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
 
-        int ki = DIV2(two_k-two_k_min);
+    //////////////////////////////////////////////////////////////////////
+    // compute the b4 matrices
+    // parallelize over the tuples if there are enough of them, 
+    // otherwise over the p indices inside
+    // with a tolerance, bisect the intervals with the largest
+    // errors (or raise the level of the nested rule) and compute
+    // again until it is met
+    //////////////////////////////////////////////////////////////////////
 
-        double w3j = S3J(two_l1, two_l2, two_k,
-                         two_p1, two_p2, -two_p1-two_p2);
-        TENSOR_SET(w3j, wt_kp1p2, 3, ki, DIV2(two_p1+two_j1), DIV2(two_p2+two_j2));
+    // errors of the previous computations with the workspace
+    double gk_err_prev = ws->gk_err;
 
-    } // k
-    } // p1
-    } // p2
+    // global grid (the bisected ones are freed here,
+    // the ones of higher levels are kept in the workspace)
+    b4_grid* g_start = g;
+    // (not relative to the starting grid, which is coarse with a tolerance)
+    int intervals_max = INTERVALS_REFINE_MAX * max(intervals, intervals_mult(INTERVAL_MULT_VERYHIGH, two_l_max));
 
     #ifdef USE_OMP
-    #pragma omp for collapse(3)
+    bool go_parallel = (n >= 4);
     #endif
-    for (dspin two_p4 = -two_j4; two_p4 <= two_j4; two_p4 += 2) {
-    for (dspin two_p3 = -two_j3; two_p3 <= two_j3; two_p3 += 2) {
-    for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
 
-        int ki = DIV2(two_k-two_k_min);
+    while (true) {
 
-        double w3j = S3J(two_k, two_l3, two_l4,
-                         -two_p3-two_p4, two_p3, two_p4);
-        TENSOR_SET(w3j, wt_kp3p4, 3, ki, DIV2(two_p3+two_j3), DIV2(two_p4+two_j4));
+        ws->gk_err = 0.0;
+        memset(g->errs, 0, g->intervals * sizeof(double));
 
-    } // k
-    } // p3
-    } // p4
+        #ifdef USE_OMP
+        #pragma omp parallel for schedule(dynamic, 1) if(OMP_PARALLELIZE && go_parallel)
+        #endif
+        for (size_t t = 0; t < n; t++) {
 
-    // now loop over all possible values
-    // loop over ps and then over i,k
-    // I need a temporary array for each thread for reduction
-    // it's faster than reversing the loops
-    // (probably due to NUMA access and first-touch policy with dtens tensor)
+            // check if there are no allowed intertwiner for this ls
+            if (!tuple_todo[t]) continue;
 
-    sl2cfoam_dmatrix b4_thread = dmatrix_alloc(dimi, dimk);
+            dspin* ls = &two_ls[4*t];
 
-    #ifdef USE_OMP
-    #pragma omp for collapse(3)
-    #endif
-    for (dspin two_p4 = -two_j4; two_p4 <= two_j4; two_p4 += 2) {
-    for (dspin two_p3 = -two_j3; two_p3 <= two_j3; two_p3 += 2) {
-    for (dspin two_p2 = -two_j2; two_p2 <= two_j2; two_p2 += 2) {
+            b4_tuple(ws, outs[t], two_j1, two_j2, two_j3, two_j4,
+                     ls[0], ls[1], ls[2], ls[3], g,
+                     ds[tuple_ds[4*t + 0]], ds[tuple_ds[4*t + 1]],
+                     ds[tuple_ds[4*t + 2]], ds[tuple_ds[4*t + 3]],
+                     wt_ip1p2, wt_ip3p4,
+                     wt_kp1p2[tuple_k12[t]], wt_kp3p4[tuple_k34[t]]);
 
-        dspin two_p1 = - two_p4 - two_p3 - two_p2;
-        if (two_p1 < -two_j1 || two_p1 > two_j1) {
-            continue;
         }
 
-        int p1i, p2i, p3i, p4i;
-        p1i = DIV2(two_p1+two_j1);
-        p2i = DIV2(two_p2+two_j2);
-        p3i = DIV2(two_p3+two_j3);
-        p4i = DIV2(two_p4+two_j4);
-        
-        double integral;
+        if (B4_TOLERANCE == 0 || ws->gk_err <= B4_TOLERANCE) break;
 
-        integral = TENSOR_GET(dtens, 4, p1i, p2i, p3i, p4i);
+        if (g->level >= 0) {
 
-        if (integral == 0.0) continue;
+            // raise the level of the nested rule
+            // computing the dsmall functions only at the new abscissae
+            if (g->level == NESTED_LEVEL_MAX) {
+                warning("b4 integrals relative error = %.3g > %.3g with nested rule of level %d",
+                        ws->gk_err, B4_TOLERANCE, g->level);
+                break;
+            }
 
-        for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
-        for (dspin two_i = two_i_min; two_i <= two_i_max; two_i += 2) {
+            verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals relative error = %.3g, raising to level %d\n",
+                 ws->gk_err, g->level + 1);
 
-            int ii = DIV2(two_i-two_i_min);
-            int ki = DIV2(two_k-two_k_min);
+            b4_grid* g_new = workspace_grid(ws, g->intervals, NESTED_POINTS(g->level + 1), g->level + 1);
 
-            // check if boost is 0 by symmetries of the 3js
-            if (((two_j1 == two_j2 && two_l2 == two_l1) || (two_j3 == two_j4  && two_l4 == two_l3))
-                && (two_k - two_i) % 4 != 0) {
+            sl2cfoam_cmatrix* ds_new = arena_array(arena, sl2cfoam_cmatrix, ds_size);
+            for (size_t di = 0; di < ds_size; di++) {
+                ds_new[di] = arena_cmatrix(arena, g_new->nxs, DIM(ds_two_j[di]));
+            }
 
-                    continue;
+            dsmall_grid(ws, ds_new, ds_two_j, ds_two_l, ds_size, g_new, ds, g);
 
-            }
+            g = g_new;
+            ds = ds_new;
+            continue;
 
-            double w3j1, w3j2, w3j3, w3j4;
-            w3j1 = TENSOR_GET(wt_ip1p2, 3, ii, p1i, p2i);
-            w3j2 = TENSOR_GET(wt_ip3p4, 3, ii, p3i, p4i);
-            w3j3 = TENSOR_GET(wt_kp1p2, 3, ki, p1i, p2i);
-            w3j4 = TENSOR_GET(wt_kp3p4, 3, ki, p3i, p4i);
+        }
 
-            double kisum;
-            kisum = real_negpow(two_i + two_k + 2*(two_p1 + two_p2)) 
-                    * w3j1 * w3j2 * w3j3 * w3j4 * integral;
-            
-            matrix_get(b4_thread, dimi, ii, ki) += kisum;
+        // bisect the intervals with errors above their share of the tolerance
+        bool* bisect = arena_array(arena, bool, g->intervals);
+        int bisected = 0;
 
-        } // i
-        } // k
+        for (int k = 0; k < g->intervals; k++) {
+            if (g->errs[k] > B4_TOLERANCE / g->intervals) {
+                bisect[k] = true;
+                bisected++;
+            }
+        }
 
-    } // p2
-    } // p3
-    } // p4
+        if (bisected == 0 || g->intervals + bisected > intervals_max) {
+            warning("b4 integrals relative error = %.3g > %.3g with %d intervals",
+                    ws->gk_err, B4_TOLERANCE, g->intervals);
+            break;
+        }
 
-    // reduce over all threads
-    #ifdef USE_OMP
-    #pragma omp critical
-    {
-    #endif
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals relative error = %.3g, bisecting %d of %d intervals\n",
+             ws->gk_err, bisected, g->intervals);
 
-    for (dspin two_k = two_k_min; two_k <= two_k_max; two_k += 2) {
-    for (dspin two_i = two_i_min; two_i <= two_i_max; two_i += 2) {
+        b4_grid* g_new = grid_create(g->intervals + bisected,
+                                     sl2cfoam_grid_bisect(g->intervals, g->grid, bisect), g->points, -1);
 
-        int ii = DIV2(two_i-two_i_min);
-        int ki = DIV2(two_k-two_k_min);
+        // the dsmall matrices are recomputed only on the new intervals
+        // (and not cached since the refined grids depend on the errors)
+        sl2cfoam_cmatrix* ds_new = arena_array(arena, sl2cfoam_cmatrix, ds_size);
+        for (size_t di = 0; di < ds_size; di++) {
+            ds_new[di] = arena_cmatrix(arena, g_new->nxs, DIM(ds_two_j[di]));
+        }
 
-        matrix_get(b4, dimi, ii, ki) += sqrt(DIM(two_i) * DIM(two_k)) 
-                                        * matrix_get(b4_thread, dimi, ii, ki);
+        int* src = arena_array(arena, int, g_new->nxs);
+        rows_bisect(src, g, bisect);
 
-    } // i
-    } // k
+        dsmall_extend(ws, ds_new, ds, g->nxs, src, ds_two_j, ds_two_l, ds_size, g_new);
+
+        if (g != g_start) sl2cfoam_b4_grid_free(g);
+
+        g = g_new;
+        ds = ds_new;
 
-    #ifdef USE_OMP
     }
-    #endif
-    
-    wig_temp_free();
 
-    #ifdef USE_OMP
-    } // omp parallel
-    #endif
+    ws->gk_err = fmax(gk_err_prev, ws->gk_err);
+    ws->gk_intervals = max(ws->gk_intervals, g->intervals);
 
-    TENSOR_FREE(dtens);
-    TENSOR_FREE(wt_ip1p2);
-    TENSOR_FREE(wt_ip3p4);
-    TENSOR_FREE(wt_kp1p2);
-    TENSOR_FREE(wt_kp3p4);
-    matrix_free(dp1);
-    matrix_free(dp2);
-    matrix_free(dp3);
-    matrix_free(dp4);
-    free(grid);
-    free(qxs);
-    free(wgks);
-    free(wgs);
+    if (g != g_start && g->level < 0) sl2cfoam_b4_grid_free(g);
 
-    return b4;
+    sl2cfoam_arena_release(arena, mark);
 
 }
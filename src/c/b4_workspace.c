@@ -0,0 +1,225 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <omp.h>
+
+#include "common.h"
+#include "error.h"
+#include "b4_workspace.h"
+
+// alignment of the buffers (cache line)
+#define ARENA_ALIGNMENT 64
+
+static inline size_t align_up(size_t bytes) {
+    return (bytes + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+static inline void* aligned_buffer(size_t bytes) {
+
+    void* buf = aligned_alloc(ARENA_ALIGNMENT, align_up(bytes));
+    if (buf == NULL) error("error allocating b4 workspace memory");
+    return buf;
+
+}
+
+static void arena_clear(b4_arena* a) {
+
+    for (size_t i = 0; i < a->extra_num; i++) {
+        free(a->extra[i]);
+    }
+
+    free(a->block);
+    free(a->extra);
+    free(a->extra_bytes);
+
+    memset(a, 0, sizeof(b4_arena));
+
+}
+
+void* sl2cfoam_arena_alloc(b4_arena* a, size_t bytes) {
+
+    bytes = align_up(bytes > 0 ? bytes : 1);
+
+    void* buf;
+
+    if (a->extra_num == 0 && a->used + bytes <= a->size) {
+
+        buf = a->block + a->used;
+        a->used += bytes;
+
+    } else {
+
+        // block is full, take the buffer from the heap
+        // (buffers must stay in the extra list until released)
+        if (a->extra_num == a->extra_cap) {
+            a->extra_cap = a->extra_cap > 0 ? 2 * a->extra_cap : 16;
+            a->extra = (void**)realloc(a->extra, a->extra_cap * sizeof(void*));
+            a->extra_bytes = (size_t*)realloc(a->extra_bytes, a->extra_cap * sizeof(size_t));
+        }
+
+        buf = aligned_buffer(bytes);
+        a->extra[a->extra_num] = buf;
+        a->extra_bytes[a->extra_num] = bytes;
+        a->extra_num++;
+        a->extra_used += bytes;
+
+    }
+
+    size_t total = a->used + a->extra_used;
+    if (total > a->high) a->high = total;
+
+    memset(buf, 0, bytes);
+    return buf;
+
+}
+
+b4_arena_mark sl2cfoam_arena_mark(b4_arena* a) {
+
+    b4_arena_mark mark = { a->used, a->extra_num, a->extra_used };
+    return mark;
+
+}
+
+void sl2cfoam_arena_release(b4_arena* a, b4_arena_mark mark) {
+
+    while (a->extra_num > mark.extra_num) {
+        a->extra_num--;
+        free(a->extra[a->extra_num]);
+    }
+
+    a->used = mark.used;
+    a->extra_used = mark.extra_used;
+
+    // if empty, grow the block to the largest size used
+    if (a->used == 0 && a->extra_num == 0 && a->high > a->size) {
+
+        free(a->block);
+        a->block = aligned_buffer(a->high);
+        a->size = a->high;
+
+    }
+
+}
+
+void sl2cfoam_b4_workspace_enter(sl2cfoam_b4_workspace* ws) {
+
+    // one arena for each thread of the regions opened from here
+    #ifdef USE_OMP
+    ws->level = omp_get_level();
+    int num = omp_get_max_threads();
+    #else
+    ws->level = 0;
+    int num = 1;
+    #endif
+    if (num > ws->arenas_num) {
+
+        ws->arenas = (b4_arena*)realloc(ws->arenas, num * sizeof(b4_arena));
+        memset(ws->arenas + ws->arenas_num, 0, (num - ws->arenas_num) * sizeof(b4_arena));
+        ws->arenas_num = num;
+
+    }
+
+}
+
+b4_arena* sl2cfoam_b4_workspace_arena(sl2cfoam_b4_workspace* ws) {
+
+    // only one level of parallelism is active (see setup)
+    // so the thread number is not 0 at most in one of the
+    // regions opened after entering the workspace
+    int thread = 0;
+    #ifdef USE_OMP
+    for (int l = ws->level + 1; l <= omp_get_level(); l++) {
+        thread += omp_get_ancestor_thread_num(l);
+    }
+    #endif
+
+    if (thread >= ws->arenas_num) {
+        error("b4 workspace used by too many threads");
+    }
+
+    return &ws->arenas[thread];
+
+}
+
+sl2cfoam_b4_workspace* sl2cfoam_b4_workspace_create() {
+
+    sl2cfoam_b4_workspace* ws = (sl2cfoam_b4_workspace*)calloc(1, sizeof(sl2cfoam_b4_workspace));
+    return ws;
+
+}
+
+void sl2cfoam_b4_workspace_reset(sl2cfoam_b4_workspace* ws) {
+
+    // empty the arenas, growing the blocks to the largest size used
+    b4_arena_mark empty = { 0, 0, 0 };
+    for (int i = 0; i < ws->arenas_num; i++) {
+        sl2cfoam_arena_release(&ws->arenas[i], empty);
+    }
+
+    ws->gk_err = 0.0;
+    ws->gk_intervals = 0;
+
+}
+
+void sl2cfoam_b4_workspace_trim(sl2cfoam_b4_workspace* ws) {
+
+    for (int i = 0; i < ws->arenas_num; i++) {
+        arena_clear(&ws->arenas[i]);
+    }
+
+    free(ws->arenas);
+    ws->arenas = NULL;
+    ws->arenas_num = 0;
+
+    b4_grid* g = ws->grids;
+    while (g != NULL) {
+
+        b4_grid* next = g->next;
+        sl2cfoam_b4_grid_free(g);
+        g = next;
+
+    }
+
+    ws->grids = NULL;
+
+}
+
+void sl2cfoam_b4_grid_free(b4_grid* g) {
+
+    free(g->grid);
+    free(g->qxs);
+    free(g->measure);
+    free(g->wgks);
+    free(g->wgs);
+    free(g->wms);
+    free(g->wdms);
+    free(g->errs);
+    free(g);
+
+}
+
+void sl2cfoam_b4_workspace_free(sl2cfoam_b4_workspace* ws) {
+
+    if (ws == NULL) return;
+
+    sl2cfoam_b4_workspace_trim(ws);
+    free(ws);
+
+}
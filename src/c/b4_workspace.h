@@ -0,0 +1,129 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SL2CFOAM_B4_WORKSPACE_H__
+#define __SL2CFOAM_B4_WORKSPACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************/
+
+#include <quadmath.h>
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////
+// Workspace for the b4 coefficients.
+//
+// All the buffers of a b4 computation are taken from arenas,
+// one for each thread. An arena is a single block of memory
+// used as a stack: buffers are released in reverse order by
+// going back to a mark. If a block is full the new buffers
+// are allocated on the heap; when the arena is empty again
+// the block is enlarged to the largest size used, so that
+// after the first calls nothing is allocated anymore.
+//
+// The workspace also keeps the harmonic integration grids with their
+// weights and measures, keyed by the number of intervals and the rule, and
+// the largest integration errors and intervals of the computations
+// done with it (see sl2cfoam_b4_workspace_reset).
+////////////////////////////////////////////////////////////////
+
+typedef struct b4_arena {
+    char* block;    // main block
+    size_t size;    // size of the main block
+    size_t used;    // bytes used in the main block
+    size_t high;    // largest number of bytes used
+    void** extra;   // buffers on the heap when the block is full
+    size_t* extra_bytes;
+    size_t extra_num;
+    size_t extra_cap;
+    size_t extra_used;  // bytes used in the extra buffers
+} b4_arena;
+
+// Position in an arena to go back to.
+typedef struct b4_arena_mark {
+    size_t used;
+    size_t extra_num;
+    size_t extra_used;
+} b4_arena_mark;
+
+// Integration grid with given number of intervals.
+typedef struct b4_grid {
+    int intervals;
+    int points;           // points per interval
+    int level;            // level of the nested rule (-1 for Gauss-Kronrod)
+    int nxs;
+    __float128* grid;
+    __float128* qxs;      // abscissae
+    __float128 dx_min;    // smallest abscissa
+    double* measure;      // dsmall measure at the abscissae
+    double* wgks;         // Gauss-Kronrod weights
+    double* wgs;          // Gauss weights
+    double* wms;          // Kronrod weights times measure
+    double* wdms;         // (Kronrod - Gauss) weights times measure
+    double* errs;         // largest relative error of the integrals on each interval
+    uint64_t hash;        // for the dsmall cache
+    struct b4_grid* next;
+} b4_grid;
+
+struct sl2cfoam_b4_workspace {
+    b4_arena* arenas;
+    int arenas_num;
+    int level;            // OpenMP nesting level of the caller
+    b4_grid* grids;       // list of the grids used so far
+    double gk_err;        // largest relative error estimate of the integrals
+    int gk_intervals;     // largest number of intervals used
+};
+
+// Frees an integration grid.
+void sl2cfoam_b4_grid_free(b4_grid* g);
+
+// Prepares the workspace for a computation started at the current
+// OpenMP nesting level. Must be called outside of parallel regions
+// opened by the b4 functions.
+void sl2cfoam_b4_workspace_enter(sl2cfoam_b4_workspace* ws);
+
+// Returns the arena of the calling thread.
+b4_arena* sl2cfoam_b4_workspace_arena(sl2cfoam_b4_workspace* ws);
+
+// Returns a buffer of given size from the arena, set to 0
+// and aligned to 64 bytes.
+void* sl2cfoam_arena_alloc(b4_arena* a, size_t bytes);
+
+// Returns the current position of the arena.
+b4_arena_mark sl2cfoam_arena_mark(b4_arena* a);
+
+// Releases all the buffers taken after the given mark.
+void sl2cfoam_arena_release(b4_arena* a, b4_arena_mark mark);
+
+// Buffers from the arena.
+#define arena_dmatrix(a, d1, d2) ((sl2cfoam_dmatrix)sl2cfoam_arena_alloc(a, (size_t)(d1) * (d2) * sizeof(double)))
+#define arena_cmatrix(a, d1, d2) ((sl2cfoam_cmatrix)sl2cfoam_arena_alloc(a, (size_t)(d1) * (d2) * sizeof(double complex)))
+#define arena_array(a, type, n)  ((type*)sl2cfoam_arena_alloc(a, (size_t)(n) * sizeof(type)))
+
+/**********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*__SL2CFOAM_B4_WORKSPACE_H__*/
@@ -17,6 +17,7 @@
  *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
 #include <omp.h>
 
 #include "common.h"
@@ -24,6 +25,7 @@
 #include "utils.h"
 #include "mpi_utils.h"
 #include "boosters.h"
+#include "b4_workspace.h"
 #include "sl2cfoam.h"
 #include "sl2cfoam_tensors.h"
 
@@ -87,9 +89,10 @@ static inline void fill_ldim(int gf, size_t ldim, size_t dims[4]) {
 
 }
 
-sl2cfoam_tensor_boosters* sl2cfoam_boosters(int gf,
-                                            dspin two_ja, dspin two_jb, dspin two_jc,  dspin two_jd, 
-                                            int Dl, bool store) {
+// Computes a booster tensor using the given workspace for the b4 coefficients.
+static sl2cfoam_tensor_boosters* boosters_ws(sl2cfoam_b4_workspace* ws, int gf,
+                                             dspin two_ja, dspin two_jb, dspin two_jc,  dspin two_jd, 
+                                             int Dl, bool store) {
 
     MPI_FUNC_INIT();
 
@@ -308,6 +311,16 @@ MPI_MASTERONLY_END
         }
     }
 
+    // with a shared grid all the b4 integrals of the tensor use
+    // the grid fixed by the largest l, so that the dsmall matrices
+    // can be reused across different l-tuples
+    int shared_intervals = 0;
+    int shared_points = 0;
+    if (BOOSTERS_SHARED_GRID) {
+        shared_intervals = sl2cfoam_b4_intervals(max4(two_la_max, two_lb_max, two_lc_max, two_ld_max));
+        shared_points = sl2cfoam_b4_points(two_ja, two_jb, two_jc, two_jd);
+    }
+
     //////////////////////////////////////////////////////////////////////
     // compute the virtual spins ls to be summed over
     // - in MPI the ls are interleaved across the available nodes and then
@@ -346,15 +359,11 @@ MPI_MASTERONLY_END
     } // lc
     } // ld
 
-    // check if to enable parallelization or not at this level
-    // do NOT if the ls to compute (on this node if MPI) are < 4
-    // (simplified case or MPI)
-    bool go_parallel = true;
-    if (ls_todo_size < 4) go_parallel = false;
+    // tuples to compute and their destinations in the tensor
+    dspin* ls_compute = (dspin*)malloc(ls_todo_size * 4 * sizeof(dspin));
+    sl2cfoam_dmatrix* dst_compute = (sl2cfoam_dmatrix*)malloc(ls_todo_size * sizeof(sl2cfoam_dmatrix));
+    size_t ls_compute_size = 0;
 
-    #ifdef USE_OMP
-    #pragma omp parallel for schedule(dynamic, 1) if(OMP_PARALLELIZE && go_parallel)
-    #endif
     for (size_t lind = 0; lind < ls_todo_size; lind++) {
 
         dspin two_la = ls_todo[lind * 4 + 0];
@@ -368,8 +377,6 @@ MPI_MASTERONLY_END
         // check if there are no allowed intertwiner for this ls
         if (two_k_max < two_k_min) continue;
 
-        dspin kdim = DIV2(two_k_max - two_k_min) + 1;
-
         // matrices with found values
         // NB: the matrices have same number of rows but different number of columns
         //     can copy whole matrix (thanks to column-major)
@@ -402,14 +409,38 @@ MPI_MASTERONLY_END
         }
 
         // must compute
+        memcpy(&ls_compute[ls_compute_size * 4], &ls_todo[lind * 4], 4 * sizeof(dspin));
+        dst_compute[ls_compute_size] = dst;
+        ls_compute_size++;
 
-        sl2cfoam_dmatrix b4_ik = sl2cfoam_b4(two_ja, two_jb, two_jc, two_jd,
-                                             two_la, two_lb, two_lc, two_ld);
+    }
+
+    // compute all the remaining b4 matrices in place
+    // (parallelization is done inside over the ls if enough of them)
+    ws->gk_err = 0.0;
+    ws->gk_intervals = 0;
 
-        memcpy(dst, b4_ik, idim * kdim * sizeof(double));
+    if (BOOSTERS_SHARED_GRID) {
+        sl2cfoam_b4_batch_grid(ws, two_ja, two_jb, two_jc, two_jd,
+                               ls_compute_size, ls_compute, dst_compute,
+                               shared_intervals, shared_points);
+    } else {
+        sl2cfoam_b4_batch_ws(ws, two_ja, two_jb, two_jc, two_jd,
+                             ls_compute_size, ls_compute, dst_compute);
+    }
 
-        matrix_free(b4_ik);
+    free(ls_todo);
+    free(ls_compute);
+    free(dst_compute);
 
+    // record the accuracy reached, including the values
+    // taken from the tensor found
+    sl2cfoam_boosters_tag tag = { ws->gk_err, ws->gk_intervals };
+
+    if (found) {
+        sl2cfoam_boosters_tag* tag_found = (sl2cfoam_boosters_tag*)b4t_found->tag;
+        tag.gk_err = fmax(tag.gk_err, tag_found->gk_err);
+        tag.intervals = max(tag.intervals, tag_found->intervals);
     }
 
     #ifdef USE_MPI
@@ -421,8 +452,13 @@ MPI_MASTERONLY_END
         MPI_Reduce(b4t->d, b4t->d, b4t->dim, MPI_DOUBLE, MPI_SUM, MPI_MASTER, MPI_COMM_WORLD);
     }
 
+    MPI_Allreduce(MPI_IN_PLACE, &tag.gk_err, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &tag.intervals, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
     #endif
 
+    TENSOR_TAG(b4t, &tag, sizeof(sl2cfoam_boosters_tag));
+
     if (store) {
         MPI_MASTERONLY_DO TENSOR_STORE(b4t, path);
     }
@@ -444,6 +480,20 @@ tensor_return:
     
 }
 
+sl2cfoam_tensor_boosters* sl2cfoam_boosters(int gf,
+                                            dspin two_ja, dspin two_jb, dspin two_jc,  dspin two_jd, 
+                                            int Dl, bool store) {
+
+    sl2cfoam_b4_workspace* ws = sl2cfoam_b4_workspace_create();
+
+    sl2cfoam_tensor_boosters* b4t = boosters_ws(ws, gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
+
+    sl2cfoam_b4_workspace_free(ws);
+
+    return b4t;
+
+}
+
 void sl2cfoam_boosters_tensors_vertex(dspin two_js[10], int Dl,
                                       tensor_ptr(boosters)* b2, tensor_ptr(boosters)* b3,
                                       tensor_ptr(boosters)* b4, tensor_ptr(boosters)* b5,
@@ -467,6 +517,9 @@ void sl2cfoam_boosters_tensors_vertex(dspin two_js[10], int Dl,
     dspin two_ja, two_jb, two_jc, two_jd;
 
     // compute all boosters and store the tensors
+    // (the buffers for the b4 coefficients are reused)
+
+    sl2cfoam_b4_workspace* ws = sl2cfoam_b4_workspace_create();
 
     bool store = true;
 
@@ -477,27 +530,29 @@ void sl2cfoam_boosters_tensors_vertex(dspin two_js[10], int Dl,
     // booster 2
     MAP_SPINS_2(two_ja, two_jb, two_jc, two_jd, gf);
 
-    *b2 = sl2cfoam_boosters(gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
+    *b2 = boosters_ws(ws, gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
     b_two_i_mins[0] = max(abs(two_ja-two_jb), abs(two_jc-two_jd));
 
     // booster 3
     MAP_SPINS_3(two_ja, two_jb, two_jc, two_jd, gf);
 
-    *b3 = sl2cfoam_boosters(gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
+    *b3 = boosters_ws(ws, gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
     b_two_i_mins[1] = max(abs(two_ja-two_jb), abs(two_jc-two_jd));
 
     // booster 4
     MAP_SPINS_4(two_ja, two_jb, two_jc, two_jd, gf);
 
-    *b4 = sl2cfoam_boosters(gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
+    *b4 = boosters_ws(ws, gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
     b_two_i_mins[2] = max(abs(two_ja-two_jb), abs(two_jc-two_jd));
 
     // booster 5
     MAP_SPINS_5(two_ja, two_jb, two_jc, two_jd, gf);
 
-    *b5 = sl2cfoam_boosters(gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
+    *b5 = boosters_ws(ws, gf, two_ja, two_jb, two_jc, two_jd, Dl, store);
     b_two_i_mins[3] = max(abs(two_ja-two_jb), abs(two_jc-two_jd));
 
+    sl2cfoam_b4_workspace_free(ws);
+
 }
 
 sl2cfoam_tensor_boosters* sl2cfoam_boosters_load(int gf,
@@ -42,6 +42,23 @@ void sl2cfoam_boosters_tensors_vertex(dspin two_js[10], int Dl,
                                       tensor_ptr(boosters)* b4, tensor_ptr(boosters)* b5,
                                       dspin b_two_i_mins[4]);
 
+// Returns the number of intervals of the integration grid
+// used for the b4 coefficients with given maximum spin l.
+int sl2cfoam_b4_intervals(dspin two_l_max);
+
+// Returns the number of points per interval of the Gauss-Kronrod rule
+// used for the b4 coefficients with given spins j: the smallest rule
+// as accurate as the default one for the accuracy and Immirzi parameter.
+int sl2cfoam_b4_points(dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4);
+
+// Computes the b4 coefficients as sl2cfoam_b4_batch but integrating
+// all the l-tuples on the grid with given number of intervals
+// and points per interval.
+void sl2cfoam_b4_batch_grid(sl2cfoam_b4_workspace* ws,
+                            dspin two_j1, dspin two_j2, dspin two_j3, dspin two_j4,
+                            size_t n, dspin* two_ls, sl2cfoam_dmatrix* outs,
+                            int intervals, int points);
+
 /**********************************************************************/
 
 #ifdef __cplusplus
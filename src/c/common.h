@@ -61,6 +61,7 @@ extern char* DATA_ROOT;
 extern double IMMIRZI;
 extern char* DIR_BOOSTERS;
 extern char* DIR_AMPLS;
+extern char* DIR_DSMALL;
 
 ///////////////////////////////////////////////////////////////
 // Accuracy parameter.
@@ -77,6 +78,39 @@ extern int MPBITS;
 
 extern bool OMP_PARALLELIZE;
 
+///////////////////////////////////////////////////////////////
+// Controls the integration grid of the booster tensors.
+// If set a single grid is used for the whole tensor.
+// Per-tuple grids are used by default.
+///////////////////////////////////////////////////////////////
+
+extern bool BOOSTERS_SHARED_GRID;
+
+///////////////////////////////////////////////////////////////
+// Method for the integrals of the b4 coefficients.
+///////////////////////////////////////////////////////////////
+
+extern int B4_INTEGRATION;
+
+///////////////////////////////////////////////////////////////
+// Algorithm for the b4 coefficients.
+///////////////////////////////////////////////////////////////
+
+extern int B4_ENGINE;
+
+///////////////////////////////////////////////////////////////
+// Target relative tolerance for the integrals of the b4
+// coefficients (0 = number of intervals fixed by accuracy).
+///////////////////////////////////////////////////////////////
+
+extern double B4_TOLERANCE;
+
+///////////////////////////////////////////////////////////////
+// Quadrature rule for the b4 integrals.
+///////////////////////////////////////////////////////////////
+
+extern int B4_QUADRATURE;
+
 ///////////////////////////////////////////////////////////////
 // Global configuration object. Set at library initialization.
 ///////////////////////////////////////////////////////////////
@@ -38,6 +38,10 @@ extern "C" {
 #define RHO(j) (IMMIRZI * ((j) + 1.0)) // default [ gamma * ( j + 1 ) ]
 #endif
 
+// Check the Y coefficients of the dsmall functions
+// against the direct formula (slow, for testing).
+// #define DSMALL_CHECK_YC
+
 // Switch between to direct computation 
 // for wigner symbols if IO is disabled.
 
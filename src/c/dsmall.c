@@ -17,7 +17,9 @@
  *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
 #include <complex.h>
+#include <float.h>
 #include <quadmath.h>
 #include <omp.h>
 
@@ -28,6 +30,8 @@
 #include "common.h"
 #include "utils.h"
 #include "error.h"
+#include "mp_pool.h"
+#include "factorials.h"
 
 // Conventions: the map to Speziale is
 //
@@ -41,6 +45,8 @@
 //
 // j2 is j', j1 is j.
 
+#ifdef DSMALL_CHECK_YC
+
 static inline void alpha(mpc_t a, int prec, double rho, 
                          dspin two_J, dspin two_j2, dspin two_j1, dspin two_p,
                          int s2, int s1, int m) {
@@ -48,12 +54,12 @@ static inline void alpha(mpc_t a, int prec, double rho,
     double j1mm = SPIN(two_j1) - m;
     int Jmp = DIV2(abs(two_J-two_p)); // |J-p|                                         
 
-    mpc_t prod;
-    mpc_init2(prod, prec);
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+
+    mpc_ptr prod = sl2cfoam_mpc_borrow(prec);
     mpc_set_d_d(prod, j1mm, -rho, MPC_RNDNN);
 
-    mpc_t pc;
-    mpc_init2(pc, prec);
+    mpc_ptr pc = sl2cfoam_mpc_borrow(prec);
 
     // complex product
     int k_max = Jmp + s1 + s2;
@@ -66,23 +72,87 @@ static inline void alpha(mpc_t a, int prec, double rho,
     mpz_t bz;
     mpz_init(bz);
 
-    mpfr_t bf;
-    mpfr_init2(bf, prec);
+    mpfr_ptr bf = sl2cfoam_mpfr_borrow(prec);
 
-    mpz_set_si(bz, DIV2(two_j1 + two_j2) - Jmp - s1 - s2);
-    mpz_bin_ui(bz, bz, m);
-    mpfr_set_z(bf, bz, MPFR_RNDN);
+    mpfr_set_z(bf, sl2cfoam_binomial(DIV2(two_j1 + two_j2) - Jmp - s1 - s2, m, bz), MPFR_RNDN);
 
     mpc_fr_div(a, bf, prod, MPC_RNDNN);
 
     // clear
-    mpc_clear(prod);
-    mpc_clear(pc);
-    mpfr_clear(bf);
     mpz_clear(bz);
+    sl2cfoam_mp_release(mark);
+
+}
+
+// Sum over (s1, s2) for index m with the direct formula.
+static void Yc_sum_direct(mpc_ptr sum, int m, int prec, double rho,
+                          dspin two_J, dspin two_j1, dspin two_j2, dspin two_p,
+                          int s1_max, int s2_max, mpfr_ptr fN[]) {
+
+    int Jmp = DIV2(abs(two_J-two_p)); // |J-p|
+
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+    mpc_ptr psum = sl2cfoam_mpc_borrow(prec);
+
+    mpc_set_ui(sum, 0, MPC_RNDNN);
+
+    for (int s1 = 0; s1 <= s1_max; s1++) {
+
+        int deltam_up = DIV2(two_j1 + two_j2) - Jmp - s1;
+        if (m > deltam_up) continue;
+
+    for (int s2 = 0; s2 <= s2_max; s2++) {
+
+        int deltam_down = s2;
+        if (m < deltam_down) continue;
+
+        // multiply alpha and sum
+
+        alpha(psum, prec, rho,
+              two_J, two_j2, two_j1, two_p, s2, s1, m-s2);
+        mpc_mul_si(psum, psum, real_negpow(2 * (m - s1)), MPC_RNDNN);
+        mpc_mul_fr(psum, psum, fN[s1 * (s2_max+1) + s2], MPC_RNDNN);
+
+        mpc_add(sum, sum, psum, MPC_RNDNN);
+
+    }
+    }
+
+    sl2cfoam_mp_release(mark);
 
 }
 
+// Warns if the sum differs from the direct formula
+// by more than the last 32 bits of precision.
+static void Yc_check(mpc_ptr sum, int m, int prec, double rho,
+                     dspin two_J, dspin two_j1, dspin two_j2, dspin two_p,
+                     int s1_max, int s2_max, mpfr_ptr fN[]) {
+
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+
+    mpc_ptr ref = sl2cfoam_mpc_borrow(prec);
+    mpfr_ptr err = sl2cfoam_mpfr_borrow(prec);
+    mpfr_ptr tol = sl2cfoam_mpfr_borrow(prec);
+
+    Yc_sum_direct(ref, m, prec, rho, two_J, two_j1, two_j2, two_p, s1_max, s2_max, fN);
+
+    mpc_abs(tol, ref, MPFR_RNDN);
+    mpfr_mul_2si(tol, tol, 32 - prec, MPFR_RNDN);
+
+    mpc_sub(ref, ref, sum, MPC_RNDNN);
+    mpc_abs(err, ref, MPFR_RNDN);
+
+    if (mpfr_cmp(err, tol) > 0) {
+        warning("Y coefficient differs from direct formula: (j1, j2, J, p, m) = (%d, %d, %d, %d, %d)",
+                two_j1, two_j2, two_J, two_p, m);
+    }
+
+    sl2cfoam_mp_release(mark);
+
+}
+
+#endif
+
 void sl2cfoam_dsmall_Yc(mpc_ptr Ys[], int prec, double rho, 
                         dspin two_k, dspin two_j, dspin two_l, dspin two_p) {
 
@@ -101,121 +171,165 @@ void sl2cfoam_dsmall_Yc(mpc_ptr Ys[], int prec, double rho,
     int s1_max = DIV2(two_j1 - Jmp - Jpp);
     int s2_max = DIV2(two_j2 - Jmp - Jpp);
 
-    #ifdef USE_OMP
-    #pragma omp parallel if(OMP_PARALLELIZE)
-    {
-    #endif
-
-    mpc_t sum;
-    mpc_init2(sum, prec);
-
-    mpc_t psum;
-    mpc_init2(psum, prec);
-
-    mpfr_t af;
-    mpfr_init2(af, prec);
+    mp_pool_mark mark = sl2cfoam_mp_mark();
 
     mpz_t az, bz;
     mpz_inits(az, bz, NULL);
 
-    int deltam_down, deltam_up;
-    int B;
+    // factors f and N (with binomials) do not depend on m
+    mpfr_ptr* fN = (mpfr_ptr*)malloc((s1_max+1) * (s2_max+1) * sizeof(mpfr_ptr));
 
-    // loop over index m
-    #ifdef USE_OMP
-    #pragma omp for
-    #endif
-    for (int m = 0; m <= m_max; m++) {
+    for (int s1 = 0; s1 <= s1_max; s1++) {
+    for (int s2 = 0; s2 <= s2_max; s2++) {
 
-        mpc_set_ui(sum, 0, MPC_RNDNN);
+        int B = Jmp + s1 + s2;
 
-        for (int s1 = 0; s1 <= s1_max; s1++) {
+        mpfr_ptr af = sl2cfoam_mpfr_borrow(prec);
 
-            deltam_up = DIV2(two_j1 + two_j2) - Jmp - s1;
-            if (m > deltam_up) continue;
+        mpfr_set_z(af, sl2cfoam_binomial(B, s1, az), MPFR_RNDN);
+        mpfr_mul_z(af, af, sl2cfoam_binomial(B, s2, az), MPFR_RNDN);
 
-        for (int s2 = 0; s2 <= s2_max; s2++) {
+        mpz_set(bz, sl2cfoam_factorial(B, az));
+        sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 + Jpp - Jmp) - s1);
+        sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 - Jpp - Jmp) - s1);
+        sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 + Jpp - Jmp) - s2);
+        sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 - Jpp - Jmp) - s2);
 
-            deltam_down = s2;
-            if (m < deltam_down) continue;
+        mpfr_div_z(af, af, bz, MPFR_RNDN);
 
-            // factors f and N (with binomials)
-            B = Jmp + s1 + s2;
+        fN[s1 * (s2_max+1) + s2] = af;
 
-            mpz_set_si(bz, B);
-            mpz_bin_ui(az, bz, s1);
-            mpfr_set_z(af, az, MPFR_RNDN);
+    }
+    }
 
-            mpz_bin_ui(az, bz, s2);
-            mpfr_mul_z(af, af, az, MPFR_RNDN);
+    // normalization prefactor
+    mpz_set_si(bz, DIM(two_j1) * DIM(two_j2));
 
-            mpz_fac_ui(bz, B);
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 + two_J));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 - two_J));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 + two_p));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j1 - two_p));
 
-            mpz_fac_ui(az, DIV2(two_j1 + Jpp - Jmp) - s1);
-            mpz_mul(bz, bz, az);
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 + two_J));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 - two_J));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 + two_p));
+    sl2cfoam_mul_factorial(bz, bz, DIV2(two_j2 - two_p));
 
-            mpz_fac_ui(az, DIV2(two_j1 - Jpp - Jmp) - s1);
-            mpz_mul(bz, bz, az);
+    mpfr_ptr norm = sl2cfoam_mpfr_borrow(prec);
+    mpfr_set_z(norm, bz, MPFR_RNDN);
+    mpfr_sqrt(norm, norm, MPFR_RNDN);
 
-            mpz_fac_ui(az, DIV2(two_j2 + Jpp - Jmp) - s2);
-            mpz_mul(bz, bz, az);
+    mpz_clears(az, bz, NULL);
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
 
-            mpz_fac_ui(az, DIV2(two_j2 - Jpp - Jmp) - s2);
-            mpz_mul(bz, bz, az);
+    mp_pool_mark mark_t = sl2cfoam_mp_mark();
 
-            mpfr_div_z(af, af, bz, MPFR_RNDN);
+    mpc_ptr sum = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr psum = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr term = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr z = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr invA = sl2cfoam_mpc_borrow(prec);
+    mpfr_ptr w = sl2cfoam_mpfr_borrow(prec);
 
-            // multiply alpha and sum
+    mpc_ptr invC[s2_max+1];
+    sl2cfoam_mpc_borrow_array(invC, s2_max+1, prec);
 
-            alpha(psum, prec, rho,
-                  two_J, two_j2, two_j1, two_p, s2, s1, m-s2);
-            mpc_mul_si(psum, psum, real_negpow(2 * (m - s1)), MPC_RNDNN);
-            mpc_mul_fr(psum, psum, af, MPC_RNDNN);
+    mpz_t tz;
+    mpz_init(tz);
 
-            mpc_add(sum, sum, psum, MPC_RNDNN);
+    // loop over index m
+    #ifdef USE_OMP
+    #pragma omp for
+    #endif
+    for (int m = 0; m <= m_max; m++) {
 
+        // The term (s1, s2) is alpha(m-s2) f N, where alpha is a binomial
+        // over the product of the factors (t - i rho) for t from
+        // j1-m-|J-p|-s1 to j1-m+s2. The product splits in the factors
+        // with t < j1-m-|J-p| (depending on s1 only), those with t > j1-m
+        // (depending on s2 only) and the ones in between (common to all
+        // the terms), so the inverse products are updated with one
+        // division for each s1 and s2 instead of computing all the
+        // products from scratch.
+
+        int s1_top = min(s1_max, DIV2(two_j1 + two_j2) - Jmp - m);
+        int s2_top = min(s2_max, m);
+
+        double j1m = SPIN(two_j1) - m;
+
+        // common factors
+        mpc_set_ui(invC[0], 1, MPC_RNDNN);
+        for (int k = 0; k <= Jmp; k++) {
+            mpc_set_d_d(z, j1m - k, -rho, MPC_RNDNN);
+            mpc_div(invC[0], invC[0], z, MPC_RNDNN);
         }
+
+        // factors depending on s2
+        for (int s2 = 1; s2 <= s2_top; s2++) {
+            mpc_set_d_d(z, j1m + s2, -rho, MPC_RNDNN);
+            mpc_div(invC[s2], invC[s2-1], z, MPC_RNDNN);
         }
 
-        // add normalization prefactor
+        mpc_set_ui(sum, 0, MPC_RNDNN);
+        mpc_set_ui(invA, 1, MPC_RNDNN);
+
+        for (int s1 = 0; s1 <= s1_top; s1++) {
+
+            // factors depending on s1
+            if (s1 > 0) {
+                mpc_set_d_d(z, j1m - Jmp - s1, -rho, MPC_RNDNN);
+                mpc_div(invA, invA, z, MPC_RNDNN);
+            }
+
+            mpc_set_ui(psum, 0, MPC_RNDNN);
+
+            for (int s2 = 0; s2 <= s2_top; s2++) {
 
-        mpz_set_si(bz, DIM(two_j1) * DIM(two_j2));
+                // binomial of alpha times f N
+                mpfr_mul_z(w, fN[s1 * (s2_max+1) + s2],
+                           sl2cfoam_binomial(DIV2(two_j1 + two_j2) - Jmp - s1 - s2, m - s2, tz),
+                           MPFR_RNDN);
 
-        mpz_fac_ui(az, DIV2(two_j1 + two_J));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j1 - two_J));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j1 + two_p));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j1 - two_p));
-        mpz_mul(bz, bz, az);
+                mpc_mul_fr(term, invC[s2], w, MPC_RNDNN);
+                mpc_add(psum, psum, term, MPC_RNDNN);
 
-        mpz_fac_ui(az, DIV2(two_j2 + two_J));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j2 - two_J));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j2 + two_p));
-        mpz_mul(bz, bz, az);
-        mpz_fac_ui(az, DIV2(two_j2 - two_p));
-        mpz_mul(bz, bz, az);
+            }
 
-        mpfr_set_z(af, bz, MPFR_RNDN);
-        mpfr_sqrt(af, af, MPFR_RNDN);
+            mpc_mul(psum, psum, invA, MPC_RNDNN);
 
-        mpc_mul_fr(Ys[m], sum, af, MPC_RNDNN);
+            if (real_negpow(2 * (m - s1)) > 0) {
+                mpc_add(sum, sum, psum, MPC_RNDNN);
+            } else {
+                mpc_sub(sum, sum, psum, MPC_RNDNN);
+            }
+
+        }
+
+        #ifdef DSMALL_CHECK_YC
+        Yc_check(sum, m, prec, rho, two_J, two_j1, two_j2, two_p, s1_max, s2_max, fN);
+        #endif
+
+        // add normalization prefactor
+        mpc_mul_fr(Ys[m], sum, norm, MPC_RNDNN);
 
     }
 
+    mpz_clear(tz);
+
     // clear
-    mpc_clear(sum);
-    mpc_clear(psum);
-    mpfr_clear(af);
-    mpz_clears(az, bz, NULL);
+    sl2cfoam_mp_release(mark_t);
 
     #ifdef USE_OMP
     } // omp parallel
     #endif
 
+    free(fN);
+    sl2cfoam_mp_release(mark);
+
 }
 
 void sl2cfoam_dsmall(__complex128 ds[], __float128 xs[], size_t N,
@@ -242,29 +356,18 @@ void sl2cfoam_dsmall(__complex128 ds[], __float128 xs[], size_t N,
     {
     #endif
 
-    mpc_t emi_r_rho_ab;
-    mpc_t sum_m;
-    mpc_t sum_n;
-    mpc_t sum;
-    mpc_t psum;
-    mpc_t pref;
-
-    mpfr_t emr_ab;
-    mpfr_t mr_rho_ab;
-    mpfr_t emr_sq_ab;
-    mpfr_t emul;
-
-    mpc_init2(sum_m, prec);
-    mpc_init2(sum_n, prec);
-    mpc_init2(sum, prec);
-    mpc_init2(emi_r_rho_ab, prec);
-    mpc_init2(psum, prec);
-    mpc_init2(pref, prec);
-
-    mpfr_init2(emr_ab, prec);
-    mpfr_init2(mr_rho_ab, prec);
-    mpfr_init2(emr_sq_ab, prec);
-    mpfr_init2(emul, prec);
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+
+    mpc_ptr emi_r_rho_ab = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr sum_m = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr sum_n = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr sum = sl2cfoam_mpc_borrow(prec);
+    mpc_ptr pref = sl2cfoam_mpc_borrow(prec);
+
+    mpfr_ptr emr_ab = sl2cfoam_mpfr_borrow(prec);
+    mpfr_ptr mr_rho_ab = sl2cfoam_mpfr_borrow(prec);
+    mpfr_ptr emr_sq_ab = sl2cfoam_mpfr_borrow(prec);
+    mpfr_ptr emul = sl2cfoam_mpfr_borrow(prec);
 
     #ifdef USE_OMP
     #pragma omp for
@@ -295,32 +398,24 @@ void sl2cfoam_dsmall(__complex128 ds[], __float128 xs[], size_t N,
             mpc_set(pref, prefactor[i], MPC_RNDNN);
         }
 
-        // sum over m
-        mpc_set_ui(sum_m, 0, MPC_RNDNN);
-        mpfr_pow_ui(emul, emr_ab, 1 + Jmp, MPFR_RNDN); // emul = exp(-r*(1 + |J-p|))
-        for (int m = 0; m <= m_max; m++) {
-
-            mpfr_set_fr(psum->re, emul, MPFR_RNDN);
-            mpfr_set_ui(psum->im, 0, MPFR_RNDN);
-            mpc_mul(psum, psum, Ym[m], MPC_RNDNN);
-            mpc_add(sum_m, sum_m, psum, MPC_RNDNN);
-            mpfr_mul(emul, emul, emr_sq_ab, MPFR_RNDN); // emul *= exp(-2r)
-
+        // sum over m, polynomial in exp(-2r) times exp(-r*(1 + |J-p|))
+        mpc_set(sum_m, Ym[m_max], MPC_RNDNN);
+        for (int m = m_max-1; m >= 0; m--) {
+            mpc_mul_fr(sum_m, sum_m, emr_sq_ab, MPC_RNDNN);
+            mpc_add(sum_m, sum_m, Ym[m], MPC_RNDNN);
         }
+        mpfr_pow_ui(emul, emr_ab, 1 + Jmp, MPFR_RNDN);
+        mpc_mul_fr(sum_m, sum_m, emul, MPC_RNDNN);
         mpc_mul(sum_m, sum_m, pref, MPC_RNDNN);
 
         // sum over n
-        mpc_set_ui(sum_n, 0, MPC_RNDNN);
-        mpfr_pow_ui(emul, emr_ab, 1 + Jpp, MPFR_RNDN);
-        for (int n = 0; n <= n_max; n++) {
-
-            mpfr_set_fr(psum->re, emul, MPFR_RNDN);
-            mpfr_set_ui(psum->im, 0, MPFR_RNDN);
-            mpc_mul(psum, psum, Yn[n], MPC_RNDNN);
-            mpc_add(sum_n, sum_n, psum, MPC_RNDNN);
-            mpfr_mul(emul, emul, emr_sq_ab, MPFR_RNDN);
-
+        mpc_set(sum_n, Yn[n_max], MPC_RNDNN);
+        for (int n = n_max-1; n >= 0; n--) {
+            mpc_mul_fr(sum_n, sum_n, emr_sq_ab, MPC_RNDNN);
+            mpc_add(sum_n, sum_n, Yn[n], MPC_RNDNN);
         }
+        mpfr_pow_ui(emul, emr_ab, 1 + Jpp, MPFR_RNDN);
+        mpc_mul_fr(sum_n, sum_n, emul, MPC_RNDNN);
         mpc_conj(pref, pref, MPC_RNDNN);
         mpc_mul(sum_n, sum_n, pref, MPC_RNDNN);
         mpc_mul_si(sum_n, sum_n, real_negpow(two_j2 - two_j1), MPC_RNDNN);
@@ -332,20 +427,598 @@ void sl2cfoam_dsmall(__complex128 ds[], __float128 xs[], size_t N,
 
     }
 
-    mpc_clear(emi_r_rho_ab);
-    mpc_clear(sum_m);
-    mpc_clear(sum_n);
-    mpc_clear(sum);
-    mpc_clear(psum);
-    mpc_clear(pref);
+    sl2cfoam_mp_release(mark);
+
+    #ifdef USE_OMP
+    } // omp parallel
+    #endif
+
+}
+
+// largest number of limbs of the sums computed in fixed point
+#define FIXED_SUM_LIMBS_MAX 8
+
+// estimated correct bits required for the dsmall values
+// computed in fixed point (as many as in quadruple precision)
+#define DSMALL_ACCURATE_BITS FLT128_MANT_DIG
+
+static inline int limbs_of(mpfr_prec_t prec) {
+    return (int)((prec + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS);
+}
+
+// Sets rop to the sum of the real (part 0) or imaginary (part 1) parts
+// of Y[k] * w[stride*k] for k = 0...num-1, using the top nlimbs limbs
+// of the Y and the w (nlimbs <= FIXED_SUM_LIMBS_MAX).
+// The products of the significands are added with mpn functions in a
+// fixed-point accumulator of nlimbs+1 limbs scaled to the largest term,
+// with some bits of headroom for the carries. Positive and negative terms
+// are accumulated separately and subtracted at the end, so that there is
+// a single rounding to the precision of rop.
+// Returns false if all the terms are zero, otherwise sets e_terms
+// to the exponent of the largest term (within 1).
+static bool fixed_sum(mpfr_ptr rop, mpfr_exp_t* e_terms,
+                      mpc_ptr Y[], int part, mpfr_ptr w[], int stride, int num, int nlimbs) {
+
+    const int n = nlimbs;
+    const int W = n + 1;
+
+    mp_limb_t pos[FIXED_SUM_LIMBS_MAX+1];
+    mp_limb_t neg[FIXED_SUM_LIMBS_MAX+1];
+    mp_limb_t prod[2*FIXED_SUM_LIMBS_MAX];
+    mp_limb_t term[FIXED_SUM_LIMBS_MAX+1];
+
+    // scale of the accumulator
+    mpfr_exp_t e_max = 0;
+    bool nonzero = false;
+    for (int k = 0; k < num; k++) {
+
+        mpfr_srcptr y = part == 0 ? mpc_realref(Y[k]) : mpc_imagref(Y[k]);
+        mpfr_srcptr wk = w[stride*k];
+        if (mpfr_zero_p(y) || mpfr_zero_p(wk)) continue;
+
+        mpfr_exp_t e = mpfr_get_exp(y) + mpfr_get_exp(wk);
+        if (!nonzero || e > e_max) e_max = e;
+        nonzero = true;
+
+    }
+
+    if (!nonzero) {
+        mpfr_set_ui(rop, 0, MPFR_RNDN);
+        return false;
+    }
+
+    *e_terms = e_max;
+
+    int headroom = 1;
+    while ((1 << (headroom - 1)) < num) headroom++;
+
+    // accumulator value is acc * 2^e_acc
+    mpfr_exp_t e_acc = e_max + headroom - (mpfr_exp_t)GMP_NUMB_BITS * W;
+
+    mpn_zero(pos, W);
+    mpn_zero(neg, W);
+
+    for (int k = 0; k < num; k++) {
+
+        mpfr_srcptr y = part == 0 ? mpc_realref(Y[k]) : mpc_imagref(Y[k]);
+        mpfr_srcptr wk = w[stride*k];
+        if (mpfr_zero_p(y) || mpfr_zero_p(wk)) continue;
+
+        // product of the significands (top n limbs)
+        const mp_limb_t* sy = (const mp_limb_t*)mpfr_custom_get_significand(y);
+        const mp_limb_t* sw = (const mp_limb_t*)mpfr_custom_get_significand(wk);
+        sy += limbs_of(mpfr_get_prec(y)) - n;
+        sw += limbs_of(mpfr_get_prec(wk)) - n;
+
+        mpn_mul_n(prod, sy, sw, n);
+
+        // product value is prod * 2^(ey + ew - 2n limbs), shift it to the accumulator
+        mpfr_exp_t shift = e_acc - (mpfr_get_exp(y) + mpfr_get_exp(wk) - (mpfr_exp_t)GMP_NUMB_BITS * 2 * n);
+        int q = (int)(shift / GMP_NUMB_BITS);
+        int r = (int)(shift % GMP_NUMB_BITS);
+        if (q >= 2 * n) continue;
+
+        int len = 2 * n - q;
+        if (r > 0) {
+            mpn_rshift(term, prod + q, len, r);
+        } else {
+            mpn_copyi(term, prod + q, len);
+        }
+        if (len < W) mpn_zero(term + len, W - len);
+
+        if (mpfr_signbit(y) == mpfr_signbit(wk)) {
+            mpn_add_n(pos, pos, term, W);
+        } else {
+            mpn_add_n(neg, neg, term, W);
+        }
+
+    }
+
+    // final difference
+    bool negative = mpn_cmp(pos, neg, W) < 0;
+    if (negative) {
+        mpn_sub_n(pos, neg, pos, W);
+    } else {
+        mpn_sub_n(pos, pos, neg, W);
+    }
+
+    mpz_t z;
+    mpfr_set_z_2exp(rop, mpz_roinit_n(z, pos, W), e_acc, MPFR_RNDN);
+    if (negative) mpfr_neg(rop, rop, MPFR_RNDN);
+
+    return true;
+
+}
+
+// Returns false if z is zero, otherwise sets e to the largest
+// exponent of the real and imaginary parts.
+static inline bool complex_exponent(mpc_srcptr z, mpfr_exp_t* e) {
+
+    bool re = !mpfr_zero_p(mpc_realref(z));
+    bool im = !mpfr_zero_p(mpc_imagref(z));
+
+    if (re) *e = mpfr_get_exp(mpc_realref(z));
+    if (im && (!re || mpfr_get_exp(mpc_imagref(z)) > *e)) *e = mpfr_get_exp(mpc_imagref(z));
+
+    return re || im;
+
+}
+
+// Bits lost by cancellation in a sum with given largest term (all_zero if
+// all the terms are zero). A zero sum of non-zero terms loses all the bits.
+static inline long cancelled_bits(mpc_srcptr sum, bool all_zero, mpfr_exp_t e_terms, long bits) {
+
+    if (all_zero) return 0;
+
+    mpfr_exp_t e_sum;
+    if (!complex_exponent(sum, &e_sum)) return bits;
+
+    return e_terms > e_sum ? (long)(e_terms - e_sum) : 0;
+
+}
+
+// Sets rop to sum_k Y[k] x^(e0 + 2k) for k = 0...num-1 with the top nlimbs
+// limbs of the Y and of the powers of x and returns the bits lost by cancellation.
+static long fixed_power_sum(mpc_ptr rop, mpc_ptr Y[], int num, mpfr_ptr pows[], int e0, int nlimbs) {
+
+    mpfr_exp_t e_re, e_im;
+    bool nz_re = fixed_sum(mpc_realref(rop), &e_re, Y, 0, pows + e0, 2, num, nlimbs);
+    bool nz_im = fixed_sum(mpc_imagref(rop), &e_im, Y, 1, pows + e0, 2, num, nlimbs);
+
+    mpfr_exp_t e_terms = nz_re ? e_re : e_im;
+    if (nz_re && nz_im && e_im > e_re) e_terms = e_im;
+
+    return cancelled_bits(rop, !nz_re && !nz_im, e_terms, GMP_NUMB_BITS * nlimbs);
+
+}
+
+// Sets rop to sum_k Y[k] x^(e0 + 2k) for k = 0...num-1 given the powers of x,
+// evaluated as a polynomial in x^2 with Horner's rule.
+static void power_sum(mpc_ptr rop, mpc_ptr Y[], int num, mpfr_ptr pows[], int e0) {
+
+    mpc_set(rop, Y[num-1], MPC_RNDNN);
+    for (int k = num-2; k >= 0; k--) {
+        mpc_mul_fr(rop, rop, pows[2], MPC_RNDNN);
+        mpc_add(rop, rop, Y[k], MPC_RNDNN);
+    }
+    mpc_mul_fr(rop, rop, pows[e0], MPC_RNDNN);
+
+}
+
+void sl2cfoam_dsmall_powers(mpfr_ptr* pows[], __float128 xs[], size_t N, int e_max, int prec) {
+
+    for (int i = 0; i < N; i++) {
+
+        sl2cfoam_mpfr_borrow_array(pows[i], e_max+1, prec);
+
+        mpfr_set_ui(pows[i][0], 1, MPFR_RNDN);
+        if (e_max == 0) continue;
+
+        mpfr_set_float128(pows[i][1], xs[i], MPFR_RNDN);
+        for (int e = 2; e <= e_max; e++) {
+            mpfr_mul(pows[i][e], pows[i][e-1], pows[i][1], MPFR_RNDN);
+        }
+
+    }
+
+}
+
+void sl2cfoam_dsmall_ladder(__complex128* ds[], bool* todo[], mpfr_ptr* pows[], size_t N,
+                            int nl, int precs[], mpc_ptr* Yms[], mpc_ptr* Yns[],
+                            mpc_ptr prefactor[], double rho,
+                            dspin two_k, dspin two_j, dspin two_ls[], dspin two_p) {
+
+    if (rho == 0) {
+        error("dsmall with rho == 0 not implemented");
+    }
+
+    // map names to Collet conventions
+    dspin two_J = two_k;
+    dspin two_j1 = two_j;
+
+    int Jmp = DIV2(abs(two_J-two_p)); // |J-p|
+    int Jpp = DIV2(abs(two_J+two_p)); // |J+p|
+
+    int prec_max = 0;
+    for (int li = 0; li < nl; li++) {
+        if (precs[li] > prec_max) prec_max = precs[li];
+    }
+
+    #ifdef USE_OMP
+    #pragma omp parallel if(OMP_PARALLELIZE)
+    {
+    #endif
+
+    mp_pool_mark mark = sl2cfoam_mp_mark();
+
+    // shared by all spins l, with the largest precision
+    mpfr_ptr inv_ab = sl2cfoam_mpfr_borrow(prec_max);
+    mpc_ptr pref_l = sl2cfoam_mpc_borrow(prec_max);
+
+    // limbs to try first for each spin l
+    int nlimbs_guess[nl];
+    for (int li = 0; li < nl; li++) nlimbs_guess[li] = 2;
+
+    #ifdef USE_OMP
+    #pragma omp for
+    #endif
+    for (int i = 0; i < N; i++) {
+
+        // 1 / (1 - exp(-2r)) for going up the ladder
+        mpfr_ui_sub(inv_ab, 1, pows[i][2], MPFR_RNDN);
+        mpfr_ui_div(inv_ab, 1, inv_ab, MPFR_RNDN);
+
+        mpc_set(pref_l, prefactor[i], MPC_RNDNN);
+
+        for (int li = 0; li < nl; li++) {
+
+            dspin two_j2 = two_ls[li];
+            int prec = precs[li];
+
+            // prefactor (1 - exp(-2r))^-((j1+j2)/2 + 1) exp(-i*r*rho)
+            if (li > 0) {
+                for (int s = 0; s < DIV2(two_ls[li] - two_ls[li-1]); s++) {
+                    mpc_mul_fr(pref_l, pref_l, inv_ab, MPC_RNDNN);
+                }
+            }
+
+            // value already known
+            if (todo != NULL && !todo[li][i]) continue;
+
+            int m_max = DIV2(two_j1 + two_j2) - Jmp;
+            int n_max = DIV2(two_j1 + two_j2) - Jpp;
+            int sign = real_negpow(two_j2 - two_j1);
+
+            // bits lost in the fixed-point sums besides cancellations
+            int bits_err = 3;
+            while ((1 << (bits_err - 3)) < max(m_max, n_max) + 1) bits_err++;
+
+            // the precision of the shell is enough for all the abscissae,
+            // try first with less limbs and check the cancellations
+            // in the sums (start from the limbs used at the previous abscissa)
+            int nlimbs_full = limbs_of(prec);
+            int nlimbs = min(nlimbs_guess[li], nlimbs_full);
+
+            bool done = false;
+            while (!done && nlimbs <= FIXED_SUM_LIMBS_MAX) {
+
+                mp_pool_mark mark_l = sl2cfoam_mp_mark();
+
+                int prec_l = min(prec, GMP_NUMB_BITS * nlimbs);
+
+                mpc_ptr sum_m = sl2cfoam_mpc_borrow(prec_l);
+                mpc_ptr sum_n = sl2cfoam_mpc_borrow(prec_l);
+                mpc_ptr sum = sl2cfoam_mpc_borrow(prec_l);
+                mpc_ptr pref = sl2cfoam_mpc_borrow(prec_l);
+
+                mpc_set(pref, pref_l, MPC_RNDNN);
+
+                // sums over m and n as below
+                long lost = fixed_power_sum(sum_m, Yms[li], m_max+1, pows[i], 1 + Jmp, nlimbs);
+                long lost_n = fixed_power_sum(sum_n, Yns[li], n_max+1, pows[i], 1 + Jpp, nlimbs);
+                if (lost_n > lost) lost = lost_n;
+
+                mpc_mul(sum_m, sum_m, pref, MPC_RNDNN);
+                mpc_conj(pref, pref, MPC_RNDNN);
+                mpc_mul(sum_n, sum_n, pref, MPC_RNDNN);
+                mpc_mul_si(sum_n, sum_n, sign, MPC_RNDNN);
+
+                mpc_add(sum, sum_m, sum_n, MPC_RNDNN);
+
+                // cancellation between the two terms
+                mpfr_exp_t e_m, e_n;
+                bool nz_m = complex_exponent(sum_m, &e_m);
+                bool nz_n = complex_exponent(sum_n, &e_n);
+                if (nz_n && (!nz_m || e_n > e_m)) e_m = e_n;
+                lost += cancelled_bits(sum, !nz_m && !nz_n, e_m, GMP_NUMB_BITS * nlimbs);
+
+                long bits = GMP_NUMB_BITS * nlimbs - bits_err - lost;
+
+                if (bits >= DSMALL_ACCURATE_BITS || nlimbs == nlimbs_full) {
 
-    mpfr_clear(mr_rho_ab);
-    mpfr_clear(emr_ab);
-    mpfr_clear(emr_sq_ab);
-    mpfr_clear(emul);
+                    ds[li][i] =       mpfr_get_float128(sum->re, MPFR_RNDN)
+                                + I * mpfr_get_float128(sum->im, MPFR_RNDN);
+
+                    // guess for the next abscissa, also dropping
+                    // the limbs that were not needed
+                    nlimbs_guess[li] = max(1, nlimbs - (int)((bits - DSMALL_ACCURATE_BITS) / GMP_NUMB_BITS));
+                    done = true;
+
+                } else {
+                    nlimbs = min(nlimbs_full, nlimbs + (int)((DSMALL_ACCURATE_BITS - bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS));
+                }
+
+                sl2cfoam_mp_release(mark_l);
+
+            }
+
+            if (done) continue;
+
+            // too many limbs for the fixed-point sums, use the full precision
+            mp_pool_mark mark_l = sl2cfoam_mp_mark();
+
+            mpc_ptr sum_m = sl2cfoam_mpc_borrow(prec);
+            mpc_ptr sum_n = sl2cfoam_mpc_borrow(prec);
+            mpc_ptr sum = sl2cfoam_mpc_borrow(prec);
+            mpc_ptr pref = sl2cfoam_mpc_borrow(prec);
+
+            mpc_set(pref, pref_l, MPC_RNDNN);
+
+            // sum over m of Y_m exp(-r*(1 + |J-p| + 2m))
+            power_sum(sum_m, Yms[li], m_max+1, pows[i], 1 + Jmp);
+            mpc_mul(sum_m, sum_m, pref, MPC_RNDNN);
+
+            // sum over n of Y_n exp(-r*(1 + |J+p| + 2n))
+            power_sum(sum_n, Yns[li], n_max+1, pows[i], 1 + Jpp);
+            mpc_conj(pref, pref, MPC_RNDNN);
+            mpc_mul(sum_n, sum_n, pref, MPC_RNDNN);
+            mpc_mul_si(sum_n, sum_n, sign, MPC_RNDNN);
+
+            mpc_add(sum, sum_m, sum_n, MPC_RNDNN);
+
+            ds[li][i] =       mpfr_get_float128(sum->re, MPFR_RNDN)
+                        + I * mpfr_get_float128(sum->im, MPFR_RNDN);
+
+            sl2cfoam_mp_release(mark_l);
+
+        }
+
+    }
+
+    sl2cfoam_mp_release(mark);
 
     #ifdef USE_OMP
     } // omp parallel
     #endif
 
-}
\ No newline at end of file
+}
+
+/////////////////////////////////////////////////////////////////////
+// Quadruple precision versions.
+/////////////////////////////////////////////////////////////////////
+
+// Binomial coefficient from the table of factorials.
+static inline __float128 binomial_q(__float128 fact[], int n, int k) {
+    return fact[n] / (fact[k] * fact[n-k]);
+}
+
+void sl2cfoam_dsmall_Yc_q(__complex128 Ys[], double Ys_abs[], double rho,
+                          dspin two_k, dspin two_j, dspin two_l, dspin two_p) {
+
+    // map names to Collet conventions
+    dspin two_J = two_k;
+    dspin two_j1 = two_j;
+    dspin two_j2 = two_l;
+
+    int Jmp = DIV2(abs(two_J-two_p)); // |J-p|
+    int Jpp = DIV2(abs(two_J+two_p)); // |J+p|
+
+    // maximum index m
+    int m_max = DIV2(two_j1 + two_j2) - Jmp;
+
+    int s1_max = DIV2(two_j1 - Jmp - Jpp);
+    int s2_max = DIV2(two_j2 - Jmp - Jpp);
+
+    // table of the factorials up to the largest argument
+    int f_max = DIV2(two_j1 + two_j2 + two_J + abs(two_p)) + 1;
+    __float128 fact[f_max+1];
+    fact[0] = 1;
+    for (int i = 1; i <= f_max; i++) fact[i] = fact[i-1] * i;
+
+    // factors f and N (with binomials) do not depend on m
+    __float128 fN[(s1_max+1) * (s2_max+1)];
+
+    for (int s1 = 0; s1 <= s1_max; s1++) {
+    for (int s2 = 0; s2 <= s2_max; s2++) {
+
+        int B = Jmp + s1 + s2;
+
+        fN[s1 * (s2_max+1) + s2] = binomial_q(fact, B, s1) * binomial_q(fact, B, s2)
+                                   / (fact[B]
+                                      * fact[DIV2(two_j1 + Jpp - Jmp) - s1]
+                                      * fact[DIV2(two_j1 - Jpp - Jmp) - s1]
+                                      * fact[DIV2(two_j2 + Jpp - Jmp) - s2]
+                                      * fact[DIV2(two_j2 - Jpp - Jmp) - s2]);
+
+    }
+    }
+
+    // normalization prefactor
+    __float128 norm = (__float128)DIM(two_j1) * DIM(two_j2)
+                      * fact[DIV2(two_j1 + two_J)] * fact[DIV2(two_j1 - two_J)]
+                      * fact[DIV2(two_j1 + two_p)] * fact[DIV2(two_j1 - two_p)]
+                      * fact[DIV2(two_j2 + two_J)] * fact[DIV2(two_j2 - two_J)]
+                      * fact[DIV2(two_j2 + two_p)] * fact[DIV2(two_j2 - two_p)];
+    norm = sqrtq(norm);
+
+    __complex128 invC[s2_max+1];
+    double invC_abs[s2_max+1];
+
+    // same algorithm as sl2cfoam_dsmall_Yc
+    for (int m = 0; m <= m_max; m++) {
+
+        int s1_top = min(s1_max, DIV2(two_j1 + two_j2) - Jmp - m);
+        int s2_top = min(s2_max, m);
+
+        __float128 j1m = SPIN(two_j1) - m;
+
+        // common factors
+        invC[0] = 1;
+        for (int k = 0; k <= Jmp; k++) {
+            invC[0] /= (j1m - k) - I * (__float128)rho;
+        }
+
+        // factors depending on s2
+        for (int s2 = 1; s2 <= s2_top; s2++) {
+            invC[s2] = invC[s2-1] / ((j1m + s2) - I * (__float128)rho);
+        }
+
+        // absolute values (in double precision, enough for the estimates)
+        for (int s2 = 0; s2 <= s2_top; s2++) {
+            invC_abs[s2] = cabs((double complex)invC[s2]);
+        }
+
+        __complex128 sum = 0;
+        __complex128 invA = 1;
+
+        // sum of the absolute values of the terms
+        double sum_abs = 0;
+
+        for (int s1 = 0; s1 <= s1_top; s1++) {
+
+            // factors depending on s1
+            if (s1 > 0) {
+                invA /= (j1m - Jmp - s1) - I * (__float128)rho;
+            }
+
+            __complex128 psum = 0;
+            double psum_abs = 0;
+
+            for (int s2 = 0; s2 <= s2_top; s2++) {
+
+                __float128 c = fN[s1 * (s2_max+1) + s2]
+                               * binomial_q(fact, DIV2(two_j1 + two_j2) - Jmp - s1 - s2, m - s2);
+
+                psum += c * invC[s2];
+                psum_abs += (double)c * invC_abs[s2];
+
+            }
+
+            sum += real_negpow(2 * (m - s1)) * invA * psum;
+            sum_abs += cabs((double complex)invA) * psum_abs;
+
+        }
+
+        Ys[m] = sum * norm;
+        Ys_abs[m] = sum_abs * (double)norm;
+
+    }
+
+}
+
+// correct bits required for the dsmall values computed
+// in quadruple precision (a few more than a double)
+#define DSMALL_QUAD_ACCURATE_BITS (DBL_MANT_DIG + 3)
+
+size_t sl2cfoam_dsmall_ladder_q(__complex128* ds[], bool* todo[], __float128* pows[], size_t N,
+                                int nl, __complex128* Yms[], __complex128* Yns[],
+                                double* Yms_abs[], double* Yns_abs[],
+                                __complex128 prefactor[], double rho,
+                                dspin two_k, dspin two_j, dspin two_ls[], dspin two_p) {
+
+    if (rho == 0) {
+        error("dsmall with rho == 0 not implemented");
+    }
+
+    // map names to Collet conventions
+    dspin two_J = two_k;
+    dspin two_j1 = two_j;
+
+    int Jmp = DIV2(abs(two_J-two_p)); // |J-p|
+    int Jpp = DIV2(abs(two_J+two_p)); // |J+p|
+
+    size_t left = 0;
+
+    // same algorithm as sl2cfoam_dsmall_ladder
+    for (int i = 0; i < N; i++) {
+
+        __float128 emr_sq = pows[i][2];
+        __float128 inv = 1 / (1 - emr_sq);
+        double emr_sq_d = (double)emr_sq;
+
+        __complex128 pref = prefactor[i];
+
+        for (int li = 0; li < nl; li++) {
+
+            dspin two_j2 = two_ls[li];
+
+            if (li > 0) {
+                for (int s = 0; s < DIV2(two_ls[li] - two_ls[li-1]); s++) {
+                    pref *= inv;
+                }
+            }
+
+            int m_max = DIV2(two_j1 + two_j2) - Jmp;
+            int n_max = DIV2(two_j1 + two_j2) - Jpp;
+
+            // sums over m and n with Horner's rule in exp(-2r)
+            // and the same sums (in double precision) of the absolute values of the terms
+            __complex128 sum_m = Yms[li][m_max];
+            double abs_m = Yms_abs[li][m_max];
+            for (int m = m_max-1; m >= 0; m--) {
+                sum_m = sum_m * emr_sq + Yms[li][m];
+                abs_m = abs_m * emr_sq_d + Yms_abs[li][m];
+            }
+            sum_m *= pows[i][1 + Jmp];
+            abs_m *= (double)pows[i][1 + Jmp];
+
+            __complex128 sum_n = Yns[li][n_max];
+            double abs_n = Yns_abs[li][n_max];
+            for (int n = n_max-1; n >= 0; n--) {
+                sum_n = sum_n * emr_sq + Yns[li][n];
+                abs_n = abs_n * emr_sq_d + Yns_abs[li][n];
+            }
+            sum_n *= pows[i][1 + Jpp];
+            abs_n *= (double)pows[i][1 + Jpp];
+
+            __complex128 d = sum_m * pref + real_negpow(two_j2 - two_j1) * sum_n * conjq(pref);
+
+            // the rounding errors are at most a few per operation (of the
+            // Y coefficients and of the sums) relative to the terms, check
+            // that they leave enough correct bits after the cancellations
+            double err = (double)FLT128_EPSILON * (8 * (two_j1 + two_j2) + 64)
+                         * cabs((double complex)pref) * (abs_m + abs_n);
+            double bound = ldexp(cabs((double complex)d), -DSMALL_QUAD_ACCURATE_BITS);
+
+            if (!(err <= bound) || isinf(err)) {
+
+                // larger spins lose even more bits
+                for (int lj = li; lj < nl; lj++) todo[lj][i] = true;
+                left += nl - li;
+                break;
+
+            }
+
+            ds[li][i] = d;
+            todo[li][i] = false;
+
+        }
+
+    }
+
+    return left;
+
+}
+
+void sl2cfoam_dsmall_powers_q(__float128* pows[], __float128 xs[], size_t N, int e_max) {
+
+    for (int i = 0; i < N; i++) {
+
+        pows[i][0] = 1;
+        for (int e = 1; e <= e_max; e++) {
+            pows[i][e] = pows[i][e-1] * xs[i];
+        }
+
+    }
+
+}
@@ -55,6 +55,48 @@ void sl2cfoam_dsmall(__complex128 ds[], __float128 xs[], size_t N,
                      double rho, dspin two_k, dspin two_j, dspin two_l, dspin two_p);
 
 
+// Sets pows[i][e] = x_i^e for e = 0...e_max for each of the N numbers x_i.
+// The numbers are borrowed from the pool of the calling thread
+// with given precision (arrays pows[i] must have e_max+1 elements).
+void sl2cfoam_dsmall_powers(mpfr_ptr* pows[], __float128 xs[], size_t N, int e_max, int prec);
+
+// Computes the dsmall coefficients for nl spins l = two_ls[0], ...
+// in ascending order at once, with given precisions and Y coefficients.
+// The powers of x are read from the table pows (see sl2cfoam_dsmall_powers)
+// which can be shared by all p and all the spins, with e_max at least
+// 2 + two_j + two_ls[nl-1] and precision at least the largest of precs.
+// The sums are evaluated as polynomials in x^2. The prefactor
+// (1-x^2)^-((j+l)/2+1) x^(i*rho) is computed only for the smallest
+// spin l (mandatory array prefactor) and then multiplied up the ladder
+// by 1/(1-x^2). The results agree with sl2cfoam_dsmall for each spin l
+// up to rounding errors. Array ds[li] is filled for spin two_ls[li].
+// If todo is not NULL only the values with todo[li][i] set are computed.
+//
+// Note that this is not a recurrence between the dsmall functions
+// of successive spins: the Collet sums are evaluated for each spin.
+void sl2cfoam_dsmall_ladder(__complex128* ds[], bool* todo[], mpfr_ptr* pows[], size_t N,
+                            int nl, int precs[], mpc_ptr* Yms[], mpc_ptr* Yns[],
+                            mpc_ptr prefactor[], double rho,
+                            dspin two_k, dspin two_j, dspin two_ls[], dspin two_p);
+
+// Versions of sl2cfoam_dsmall_Yc, sl2cfoam_dsmall_powers and sl2cfoam_dsmall_ladder
+// in quadruple precision (113 bits). The Y coefficients come with the sums of
+// the absolute values of their terms (Ys_abs), from which the ladder estimates
+// the rounding errors of each value a posteriori. Only the values with enough
+// correct bits for double precision are set in ds (todo[li][i] = false);
+// at each abscissa the spins l from the first one failing the check are
+// left to the caller (todo[li][i] = true). Returns the number of values left.
+void sl2cfoam_dsmall_Yc_q(__complex128 Ys[], double Ys_abs[], double rho,
+                          dspin two_k, dspin two_j, dspin two_l, dspin two_p);
+
+void sl2cfoam_dsmall_powers_q(__float128* pows[], __float128 xs[], size_t N, int e_max);
+
+size_t sl2cfoam_dsmall_ladder_q(__complex128* ds[], bool* todo[], __float128* pows[], size_t N,
+                                int nl, __complex128* Yms[], __complex128* Yns[],
+                                double* Yms_abs[], double* Yns_abs[],
+                                __complex128 prefactor[], double rho,
+                                dspin two_k, dspin two_j, dspin two_ls[], dspin two_p);
+
 /**********************************************************************/
 
 #ifdef __cplusplus
@@ -0,0 +1,374 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <omp.h>
+
+#include "common.h"
+#include "utils.h"
+#include "error.h"
+#include "sl2cfoam_tensors.h"
+#include "dsmall_cache.h"
+#include "dsmall_integral.h"
+
+size_t DSMALL_CACHE_MB = DSMALL_CACHE_MB_DEFAULT;
+bool DSMALL_STORE = false;
+
+// default filename for dsmall matrices
+static const char* dsmall_fn = "ds__%d-%d__acc-%d__%s__nx-%zu__grid-%016" PRIx64 ".sl2t";
+
+// Tensor for stored dsmall matrices.
+// Indices: (re/im, x, p)
+TENSOR_INIT(dsmall_store, 3);
+
+// number of buckets of the hash table
+#define DSMALL_CACHE_BUCKETS 1024
+
+typedef struct dsmall_cache_key {
+    dspin two_j;
+    dspin two_l;
+    double rho;
+    int accuracy;
+    bool integral;
+    size_t N;
+    uint64_t grid_hash;
+} dsmall_cache_key;
+
+typedef struct dsmall_cache_entry {
+    dsmall_cache_key key;
+    sl2cfoam_cmatrix m;
+    size_t bytes;
+    struct dsmall_cache_entry* next;  // next in bucket
+    struct dsmall_cache_entry* newer; // LRU list
+    struct dsmall_cache_entry* older; // LRU list
+} dsmall_cache_entry;
+
+// the cache, protected by the critical section (dsmall_cache)
+static dsmall_cache_entry* buckets[DSMALL_CACHE_BUCKETS];
+static dsmall_cache_entry* newest;
+static dsmall_cache_entry* oldest;
+static size_t cache_bytes;
+
+// FNV-1a hash
+static inline uint64_t fnv1a(const void* data, size_t nbytes, uint64_t h) {
+
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < nbytes; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+
+}
+
+static inline size_t key_bucket(dsmall_cache_key* key) {
+
+    uint64_t h = 14695981039346656037ULL;
+    h = fnv1a(&key->two_j, sizeof(dspin), h);
+    h = fnv1a(&key->two_l, sizeof(dspin), h);
+    h = fnv1a(&key->rho, sizeof(double), h);
+    h = fnv1a(&key->grid_hash, sizeof(uint64_t), h);
+    return (size_t)(h % DSMALL_CACHE_BUCKETS);
+
+}
+
+static inline bool key_equal(dsmall_cache_key* k1, dsmall_cache_key* k2) {
+
+    return k1->two_j == k2->two_j && k1->two_l == k2->two_l &&
+           k1->rho == k2->rho && k1->accuracy == k2->accuracy &&
+           k1->integral == k2->integral && k1->N == k2->N && k1->grid_hash == k2->grid_hash;
+
+}
+
+static inline dsmall_cache_entry* find(dsmall_cache_key* key) {
+
+    dsmall_cache_entry* e = buckets[key_bucket(key)];
+    while (e != NULL) {
+        if (key_equal(&e->key, key)) return e;
+        e = e->next;
+    }
+    return NULL;
+
+}
+
+static inline void lru_unlink(dsmall_cache_entry* e) {
+
+    if (e->newer != NULL) e->newer->older = e->older;
+    else newest = e->older;
+
+    if (e->older != NULL) e->older->newer = e->newer;
+    else oldest = e->newer;
+
+    e->newer = NULL;
+    e->older = NULL;
+
+}
+
+static inline void lru_push(dsmall_cache_entry* e) {
+
+    e->newer = NULL;
+    e->older = newest;
+    if (newest != NULL) newest->newer = e;
+    newest = e;
+    if (oldest == NULL) oldest = e;
+
+}
+
+static void remove_entry(dsmall_cache_entry* e) {
+
+    dsmall_cache_entry** pe = &buckets[key_bucket(&e->key)];
+    while (*pe != e) pe = &(*pe)->next;
+    *pe = e->next;
+
+    lru_unlink(e);
+
+    cache_bytes -= e->bytes;
+    matrix_free(e->m);
+    free(e);
+
+}
+
+// True if the shell is computed from the integral representation,
+// whose values differ from the exact ones within the tolerance.
+static inline bool is_integral(dspin two_l) {
+    return DSMALL_INTEGRAL_TWO_L > 0 && two_l >= DSMALL_INTEGRAL_TWO_L;
+}
+
+static inline void fill_key(dsmall_cache_key* key, dspin two_j, dspin two_l, double rho,
+                            size_t N, uint64_t grid_hash, int accuracy) {
+
+    memset(key, 0, sizeof(dsmall_cache_key));
+    key->two_j = two_j;
+    key->two_l = two_l;
+    key->rho = rho;
+    key->accuracy = accuracy;
+    key->integral = is_integral(two_l);
+    key->N = N;
+    key->grid_hash = grid_hash;
+
+}
+
+uint64_t sl2cfoam_dsmall_cache_grid_hash(__float128* xs, size_t N) {
+
+    uint64_t h = 14695981039346656037ULL;
+    h = fnv1a(&N, sizeof(size_t), h);
+    h = fnv1a(xs, N * sizeof(__float128), h);
+    return h;
+
+}
+
+static bool memory_get(sl2cfoam_cmatrix dst, dspin two_j, dspin two_l, double rho,
+                       size_t N, uint64_t grid_hash, int accuracy) {
+
+    if (DSMALL_CACHE_MB == 0) return false;
+
+    dsmall_cache_key key;
+    fill_key(&key, two_j, two_l, rho, N, grid_hash, accuracy);
+
+    bool found = false;
+
+    #ifdef USE_OMP
+    #pragma omp critical (dsmall_cache)
+    {
+    #endif
+
+    dsmall_cache_entry* e = find(&key);
+    if (e != NULL) {
+
+        memcpy(dst, e->m, e->bytes);
+
+        // mark as recently used
+        lru_unlink(e);
+        lru_push(e);
+
+        found = true;
+
+    }
+
+    #ifdef USE_OMP
+    }
+    #endif
+
+    return found;
+
+}
+
+// Inserts a copy in memory, returns false if already present
+// or if the cache is too small.
+static bool memory_put(sl2cfoam_cmatrix src, dspin two_j, dspin two_l, double rho,
+                       size_t N, uint64_t grid_hash, int accuracy) {
+
+    size_t max_bytes = DSMALL_CACHE_MB << 20;
+    size_t bytes = N * DIM(two_j) * sizeof(double complex);
+
+    if (bytes > max_bytes) return false;
+
+    dsmall_cache_entry* e = (dsmall_cache_entry*)malloc(sizeof(dsmall_cache_entry));
+    fill_key(&e->key, two_j, two_l, rho, N, grid_hash, accuracy);
+    e->bytes = bytes;
+    e->next = NULL;
+    e->newer = NULL;
+    e->older = NULL;
+
+    // copy outside the critical section
+    e->m = cmatrix_alloc(N, DIM(two_j));
+    memcpy(e->m, src, bytes);
+
+    bool inserted = false;
+
+    #ifdef USE_OMP
+    #pragma omp critical (dsmall_cache)
+    {
+    #endif
+
+    // another thread may have computed the same matrix
+    if (find(&e->key) == NULL) {
+
+        // make room
+        while (cache_bytes + bytes > max_bytes && oldest != NULL) {
+            remove_entry(oldest);
+        }
+
+        size_t b = key_bucket(&e->key);
+        e->next = buckets[b];
+        buckets[b] = e;
+
+        lru_push(e);
+        cache_bytes += bytes;
+
+        inserted = true;
+
+    }
+
+    #ifdef USE_OMP
+    }
+    #endif
+
+    if (!inserted) {
+        matrix_free(e->m);
+        free(e);
+    }
+
+    return inserted;
+
+}
+
+static inline void build_path(char* path, dspin two_j, dspin two_l, size_t N, uint64_t grid_hash, int accuracy) {
+
+    char filename[256];
+    sprintf(filename, dsmall_fn, two_j, two_l, accuracy,
+            is_integral(two_l) ? "integral" : "exact", N, grid_hash);
+
+    strcpy(path, DIR_DSMALL);
+    strcat(path, "/");
+    strcat(path, filename);
+
+}
+
+// Loads the matrix from disk into dst, returns true if found.
+static bool disk_get(sl2cfoam_cmatrix dst, dspin two_j, dspin two_l, size_t N, uint64_t grid_hash, int accuracy) {
+
+    char path[strlen(DIR_DSMALL) + 256];
+    build_path(path, two_j, two_l, N, grid_hash, accuracy);
+
+    if (!file_exist(path)) return false;
+
+    tensor_ptr(dsmall_store) t;
+    TENSOR_LOAD(dsmall_store, t, 3, path);
+
+    if (t == NULL) return false;
+
+    bool ok = (t->dims[0] == 2 && t->dims[1] == N && t->dims[2] == (size_t)DIM(two_j));
+    if (ok) {
+        memcpy(dst, t->d, t->dim * sizeof(double));
+    } else {
+        warning("dsmall file %s has wrong dimensions, ignoring it", path);
+    }
+
+    TENSOR_FREE(t);
+
+    return ok;
+
+}
+
+static void disk_put(sl2cfoam_cmatrix src, dspin two_j, dspin two_l, size_t N, uint64_t grid_hash, int accuracy) {
+
+    char path[strlen(DIR_DSMALL) + 256];
+    build_path(path, two_j, two_l, N, grid_hash, accuracy);
+
+    if (file_exist(path)) return;
+
+    tensor_ptr(dsmall_store) t;
+    TENSOR_CREATE(dsmall_store, t, 3, 2, N, DIM(two_j));
+    memcpy(t->d, src, t->dim * sizeof(double));
+
+    TENSOR_STORE(t, path);
+    TENSOR_FREE(t);
+
+}
+
+bool sl2cfoam_dsmall_cache_get(sl2cfoam_cmatrix dst, dspin two_j, dspin two_l, double rho,
+                               size_t N, uint64_t grid_hash, int accuracy) {
+
+    if (memory_get(dst, two_j, two_l, rho, N, grid_hash, accuracy)) return true;
+
+#ifndef NO_IO
+
+    if (DSMALL_STORE && disk_get(dst, two_j, two_l, N, grid_hash, accuracy)) {
+        memory_put(dst, two_j, two_l, rho, N, grid_hash, accuracy);
+        return true;
+    }
+
+#endif
+
+    return false;
+
+}
+
+void sl2cfoam_dsmall_cache_put(sl2cfoam_cmatrix src, dspin two_j, dspin two_l, double rho,
+                               size_t N, uint64_t grid_hash, int accuracy) {
+
+    memory_put(src, two_j, two_l, rho, N, grid_hash, accuracy);
+
+#ifndef NO_IO
+
+    if (DSMALL_STORE) {
+        disk_put(src, two_j, two_l, N, grid_hash, accuracy);
+    }
+
+#endif
+
+}
+
+void sl2cfoam_dsmall_cache_clear() {
+
+    #ifdef USE_OMP
+    #pragma omp critical (dsmall_cache)
+    {
+    #endif
+
+    while (oldest != NULL) {
+        remove_entry(oldest);
+    }
+
+    #ifdef USE_OMP
+    }
+    #endif
+
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SL2CFOAM_DSMALL_CACHE_H__
+#define __SL2CFOAM_DSMALL_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************/
+
+#include <quadmath.h>
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////
+// In-memory cache for the dsmall matrices used in the
+// b4 integrals. A matrix holds d^(rho, j)_{j l p}(x) (Speziale's
+// phase included) for all p (columns) and all the abscissae x
+// of an integration grid (rows). It depends only on the spins
+// (j, l), on rho, on the grid and on whether the shell is computed
+// from the integral representation (see DSMALL_INTEGRAL_TWO_L), so
+// it can be reused across all the b4 calls of a booster tensor.
+//
+// The cache is shared by all threads (access is serialized) and
+// its size is bounded by DSMALL_CACHE_MB. When full, the least
+// recently used matrices are dropped.
+//
+// If DSMALL_STORE is set the matrices are also stored on disk
+// in DIR_DSMALL and loaded from there on a miss, so that they
+// are reused across processes.
+////////////////////////////////////////////////////////////////
+
+// Default maximum size of the cache in MB.
+#define DSMALL_CACHE_MB_DEFAULT 256
+
+// Maximum size of the cache in MB (0 = cache disabled).
+extern size_t DSMALL_CACHE_MB;
+
+// Store and load the matrices on disk.
+extern bool DSMALL_STORE;
+
+// Returns an identifier for the grid with given abscissae.
+uint64_t sl2cfoam_dsmall_cache_grid_hash(__float128* xs, size_t N);
+
+// Looks for the dsmall matrix (N x DIM(two_j)) computed with given
+// accuracy level in the cache, then on disk. If found copies it into
+// dst and returns true.
+bool sl2cfoam_dsmall_cache_get(sl2cfoam_cmatrix dst, dspin two_j, dspin two_l, double rho,
+                               size_t N, uint64_t grid_hash, int accuracy);
+
+// Inserts a copy of the dsmall matrix (N x DIM(two_j)) computed with
+// given accuracy level in the cache and stores it on disk.
+// Nothing is done if the matrix is already present.
+void sl2cfoam_dsmall_cache_put(sl2cfoam_cmatrix src, dspin two_j, dspin two_l, double rho,
+                               size_t N, uint64_t grid_hash, int accuracy);
+
+// Removes all the matrices from the cache (files on disk are kept).
+void sl2cfoam_dsmall_cache_clear();
+
+/**********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*__SL2CFOAM_DSMALL_CACHE_H__*/
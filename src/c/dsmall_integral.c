@@ -0,0 +1,381 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <float.h>
+#include <complex.h>
+#include <string.h>
+
+#include "common.h"
+#include "utils.h"
+#include "error.h"
+#include "dsmall_integral.h"
+
+dspin DSMALL_INTEGRAL_TWO_L = DSMALL_INTEGRAL_TWO_L_DEFAULT;
+
+// size of the smallest rule
+#define RULE_SIZE_MIN 8
+
+// abscissae below which the rules are applied in the variable t
+#define LOG_VARIABLE_X 0.5
+
+// Computes the nodes and weights of the n-point Gauss-Legendre rule
+// with Newton's method on the Legendre polynomials.
+static void gauss_legendre(int n, double* nodes, double* weights) {
+
+    for (int i = 0; i < (n + 1) / 2; i++) {
+
+        long double z = cosl(M_PI * (i + 0.75L) / (n + 0.5L));
+        long double z1, pp;
+
+        for (int it = 0; it < 100; it++) {
+
+            long double p1 = 1.0L;
+            long double p2 = 0.0L;
+            for (int k = 1; k <= n; k++) {
+                long double p3 = p2;
+                p2 = p1;
+                p1 = ((2 * k - 1) * z * p2 - (k - 1) * p3) / k;
+            }
+
+            // derivative
+            pp = n * (z * p1 - p2) / (z * z - 1.0L);
+
+            z1 = z;
+            z = z1 - p1 / pp;
+
+            if (fabsl(z - z1) <= LDBL_EPSILON) break;
+
+        }
+
+        nodes[i] = (double)(-z);
+        nodes[n-1-i] = (double)z;
+        weights[i] = weights[n-1-i] = (double)(2.0L / ((1.0L - z * z) * pp * pp));
+
+    }
+
+}
+
+dsmall_integral_rules* sl2cfoam_dsmall_integral_rules(int n_max) {
+
+    dsmall_integral_rules* rules = (dsmall_integral_rules*)calloc(1, sizeof(dsmall_integral_rules));
+
+    int num = 0;
+    for (int n = RULE_SIZE_MIN; n <= n_max; n = (3 * n + 1) / 2) num++;
+
+    rules->num = num;
+    rules->sizes = (int*)malloc(num * sizeof(int));
+    rules->nodes = (double**)malloc(num * sizeof(double*));
+    rules->weights = (double**)malloc(num * sizeof(double*));
+
+    int n = RULE_SIZE_MIN;
+    for (int k = 0; k < num; k++) {
+
+        rules->sizes[k] = n;
+        rules->nodes[k] = (double*)malloc(n * sizeof(double));
+        rules->weights[k] = (double*)malloc(n * sizeof(double));
+
+        gauss_legendre(n, rules->nodes[k], rules->weights[k]);
+
+        n = (3 * n + 1) / 2;
+
+    }
+
+    return rules;
+
+}
+
+void sl2cfoam_dsmall_integral_rules_free(dsmall_integral_rules* rules) {
+
+    if (rules == NULL) return;
+
+    for (int k = 0; k < rules->num; k++) {
+        free(rules->nodes[k]);
+        free(rules->weights[k]);
+    }
+
+    free(rules->sizes);
+    free(rules->nodes);
+    free(rules->weights);
+    free(rules);
+
+}
+
+// Coefficients of the recursion in l for the Wigner functions d^l_{jp}
+//
+//   d^(l+1) = (a_l u - b_l) d^l - c_l d^(l-1)
+//
+// for l = j, j+1, ... (d^(j-1) = 0).
+typedef struct recursion {
+    int steps;
+    double* a;
+    double* b;
+    double* c;
+} recursion;
+
+static void recursion_init(recursion* rec, dspin two_j, dspin two_p, int steps) {
+
+    double j = SPIN(two_j);
+    double p = SPIN(two_p);
+
+    rec->steps = steps;
+    rec->a = (double*)malloc(steps * sizeof(double));
+    rec->b = (double*)malloc(steps * sizeof(double));
+    rec->c = (double*)malloc(steps * sizeof(double));
+
+    for (int s = 0; s < steps; s++) {
+
+        double l = j + s;
+
+        if (l == 0) {
+
+            // Legendre polynomials, d^1 = u
+            rec->a[s] = 1.0;
+            rec->b[s] = 0.0;
+            rec->c[s] = 0.0;
+            continue;
+
+        }
+
+        double sl  = sqrt((l * l - p * p) * (l * l - j * j));
+        double sl1 = sqrt(((l + 1) * (l + 1) - p * p) * ((l + 1) * (l + 1) - j * j));
+
+        rec->a[s] = (2 * l + 1) * (l + 1) / sl1;
+        rec->b[s] = (2 * l + 1) * p * j / (l * sl1);
+        rec->c[s] = (l + 1) * sl / (l * sl1);
+
+    }
+
+}
+
+static void recursion_free(recursion* rec) {
+    free(rec->a);
+    free(rec->b);
+    free(rec->c);
+}
+
+// Integer power by squaring.
+static inline double ipow(double b, int e) {
+
+    double res = 1.0;
+    while (e > 0) {
+        if (e & 1) res *= b;
+        b *= b;
+        e >>= 1;
+    }
+    return res;
+
+}
+
+// Applies the rule with n points at x for all the spins l, setting
+// the integrals in ints and the integrals of the absolute values in abs_ints.
+//
+// For x close to 1 the integral is computed in the variable v such that
+// u and u' are obtained from v with boosts of rapidities -r/2 and r/2.
+// Then the integrand has boundary layers of width exp(-r) at both ends,
+// while in u there is one of width exp(-2r) at u = 1.
+// For smaller x it is computed in t = log(cosh r - u sinh r) in (-r, r),
+// where the layers have width of order 1, the phase is rho t and
+// the measure is constant.
+static void rule_sums(double complex* ints, double* abs_ints, const double* nodes, const double* weights, int n,
+                      double x, double rho, dspin two_j, dspin two_p, dspin two_ls[], int nl,
+                      recursion* rec, double pref, const double* sqrt_dim_l) {
+
+    int jpp = DIV2(two_j + two_p); // j+p
+    int jmp = DIV2(two_j - two_p); // j-p
+
+    // exp(-r/2)
+    double xh = sqrt(x);
+
+    double r = -log(x);
+    double sinh_r = sinh(r);
+    double cosh_r = cosh(r);
+    bool log_var = (x < LOG_VARIABLE_X);
+
+    for (int li = 0; li < nl; li++) {
+        ints[li] = 0.0;
+        abs_ints[li] = 0.0;
+    }
+
+    for (int q = 0; q < n; q++) {
+
+        // d^j_{jp}(u) d^j_{jp}(u') without the normalization,
+        // cos(theta'/2)^2 - sin(theta'/2)^2, the phase of
+        // (cosh r - u sinh r)^(i rho - 1) and the weight times its modulus
+        double d, up, phase, af;
+
+        if (log_var) {
+
+            double t = r * nodes[q];
+
+            d = ipow(sinh(0.5 * (r - t)) / sinh_r, jpp) * ipow(sinh(0.5 * (r + t)) / sinh_r, jmp);
+            up = (exp(-t) - cosh_r) / sinh_r;
+            phase = rho * t;
+            af = weights[q] * pref * r / sinh_r;
+
+        } else {
+
+            double v = nodes[q];
+            double vp = 1.0 + v;
+            double vm = 1.0 - v;
+
+            // cosh(r/2) + v sinh(r/2) and cosh(r/2) - v sinh(r/2),
+            // so that du/dv = 1/e^2 and cosh r - u sinh r = f/e
+            double e = 0.5 * (vp / xh + vm * xh);
+            double f = 0.5 * (vp * xh + vm / xh);
+
+            double ef4 = 4.0 * e * f;
+            d = pow(vp * vp / ef4, 0.5 * jpp) * pow(vm * vm / ef4, 0.5 * jmp);
+            up = 0.5 * (xh * vp - vm / xh) / f;
+            phase = rho * log(f / e);
+            af = weights[q] * pref / (e * f);
+
+        }
+
+        double d_prev = 0.0;
+        double complex w = af * (cos(phase) + I * sin(phase));
+
+        int li = 0;
+        for (int s = 0; ; s++) {
+
+            if (two_j + 2 * s == two_ls[li]) {
+
+                ints[li] += w * d * sqrt_dim_l[li];
+                abs_ints[li] += af * fabs(d) * sqrt_dim_l[li];
+
+                li++;
+                if (li == nl) break;
+
+            }
+
+            double d_next = (rec->a[s] * up - rec->b[s]) * d - rec->c[s] * d_prev;
+            d_prev = d;
+            d = d_next;
+
+        }
+
+    }
+
+}
+
+size_t sl2cfoam_dsmall_integral_ladder(__complex128* ds[], bool* todo[], __float128 xs[], size_t N,
+                                       int nl, dsmall_integral_rules* rules, double tol,
+                                       double rho, dspin two_j, dspin two_ls[], dspin two_p) {
+
+    size_t left = 0;
+
+    if (rules->num < 2) {
+
+        for (int li = 0; li < nl; li++) {
+            for (size_t i = 0; i < N; i++) todo[li][i] = true;
+        }
+        return N * nl;
+
+    }
+
+    recursion rec;
+    recursion_init(&rec, two_j, two_p, DIV2(two_ls[nl-1] - two_j));
+
+    // sqrt(2j+1) / 2 and the normalization of d^j_{jp} for both functions
+    double pref = 0.5 * sqrt(two_j + 1.0)
+                * exp(lgamma(two_j + 1.0) - lgamma(SPIN(two_j + two_p) + 1.0) - lgamma(SPIN(two_j - two_p) + 1.0));
+
+    double* sqrt_dim_l = (double*)malloc(nl * sizeof(double));
+    for (int li = 0; li < nl; li++) {
+        sqrt_dim_l[li] = sqrt(two_ls[li] + 1.0);
+    }
+
+    double complex* I_prev = (double complex*)malloc(nl * sizeof(double complex));
+    double complex* I_next = (double complex*)malloc(nl * sizeof(double complex));
+    double* A_prev = (double*)malloc(nl * sizeof(double));
+    double* A_next = (double*)malloc(nl * sizeof(double));
+    double* err = (double*)malloc(nl * sizeof(double));
+
+    // rounding errors grow with the steps of the recursion
+    double eps_round = 8.0 * DBL_EPSILON * (rec.steps + 8);
+
+    // rule to start with, from the one used at the previous abscissa
+    int k_start = 0;
+
+    for (size_t i = 0; i < N; i++) {
+
+        double x = (double)xs[i];
+        int k = k_start;
+
+        rule_sums(I_prev, A_prev, rules->nodes[k], rules->weights[k], rules->sizes[k],
+                  x, rho, two_j, two_p, two_ls, nl, &rec, pref, sqrt_dim_l);
+
+        while (true) {
+
+            rule_sums(I_next, A_next, rules->nodes[k+1], rules->weights[k+1], rules->sizes[k+1],
+                      x, rho, two_j, two_p, two_ls, nl, &rec, pref, sqrt_dim_l);
+
+            // the difference estimates the error of the smaller rule
+            bool done = true;
+            bool hopeless = true;
+            for (int li = 0; li < nl; li++) {
+
+                double err_round = eps_round * A_next[li];
+                err[li] = cabs(I_next[li] - I_prev[li]) + err_round;
+
+                if (err[li] > tol) {
+                    done = false;
+                    if (err_round <= tol) hopeless = false;
+                }
+
+            }
+
+            if (done || hopeless || k + 2 >= rules->num) break;
+
+            double complex* I_swap = I_prev;
+            I_prev = I_next;
+            I_next = I_swap;
+
+            k++;
+
+        }
+
+        for (int li = 0; li < nl; li++) {
+
+            if (err[li] <= tol) {
+                ds[li][i] = I_next[li];
+                todo[li][i] = false;
+            } else {
+                todo[li][i] = true;
+                left++;
+            }
+
+        }
+
+        k_start = k > 0 ? k - 1 : 0;
+
+    }
+
+    recursion_free(&rec);
+
+    free(sqrt_dim_l);
+    free(I_prev);
+    free(I_next);
+    free(A_prev);
+    free(A_next);
+    free(err);
+
+    return left;
+
+}
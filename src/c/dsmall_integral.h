@@ -0,0 +1,90 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SL2CFOAM_DSMALL_INTEGRAL_H__
+#define __SL2CFOAM_DSMALL_INTEGRAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************/
+
+#include <quadmath.h>
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////
+// Evaluation of the dsmall functions for large spins l from
+// the integral representation over the boost angle
+//
+//  d^(rho, j)_{j l p}(r) = sqrt(2j+1) sqrt(2l+1) / 2 *
+//      int_{-1}^{1} du d^j_{jp}(u) d^l_{jp}(u') (cosh r - u sinh r)^(i rho - 1)
+//
+// with u' = (u cosh r - sinh r) / (cosh r - u sinh r) and d^j the
+// Wigner functions of SU(2) (as functions of the cosine of the angle).
+// The integrand is smooth and bounded, so that the integral can be
+// computed in double precision with Gauss-Legendre rules, while the
+// Collet sums need hundreds of bits for large l. The functions d^l
+// for all the spins l are obtained with the three-term recursion in l.
+//
+// The error of each value is estimated from the difference
+// of two consecutive rules and from the rounding errors.
+// The values are the same as the ones of sl2cfoam_dsmall
+// (without Speziale's phase) within the error.
+////////////////////////////////////////////////////////////////
+
+// Default smallest 2l for using the integral representation (disabled).
+#define DSMALL_INTEGRAL_TWO_L_DEFAULT 0
+
+// Smallest 2l for using the integral representation (0 = never).
+extern dspin DSMALL_INTEGRAL_TWO_L;
+
+// Gauss-Legendre rules on (-1 1) with sizes growing by a factor 3/2.
+typedef struct dsmall_integral_rules {
+    int num;
+    int* sizes;
+    double** nodes;
+    double** weights;
+} dsmall_integral_rules;
+
+// Computes the rules with at most n_max points.
+dsmall_integral_rules* sl2cfoam_dsmall_integral_rules(int n_max);
+
+// Frees the rules.
+void sl2cfoam_dsmall_integral_rules_free(dsmall_integral_rules* rules);
+
+// Computes d^(rho, j)_{j l p}(x) with x = exp(-r) for the nl spins
+// l = two_ls[0] < two_ls[1] < ... (all l - j integers) and the N abscissae xs.
+// Rules are tried in ascending size until the estimated absolute error
+// is less than tol for all the spins. The values with smaller errors
+// are set in ds[li][i] and todo[li][i] is set to false, the others
+// are left to be computed exactly with todo[li][i] = true.
+// Returns the number of values left to compute.
+size_t sl2cfoam_dsmall_integral_ladder(__complex128* ds[], bool* todo[], __float128 xs[], size_t N,
+                                       int nl, dsmall_integral_rules* rules, double tol,
+                                       double rho, dspin two_j, dspin two_ls[], dspin two_p);
+
+/**********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*__SL2CFOAM_DSMALL_INTEGRAL_H__*/
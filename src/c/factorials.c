@@ -0,0 +1,95 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmp.h>
+
+#include "common.h"
+#include "utils.h"
+#include "factorials.h"
+
+unsigned long FACTORIALS_NUM;
+mpz_t* FACTORIALS;
+mpz_t** BINOMIALS;
+
+// index of row n in the triangle of binomials
+static inline size_t row_offset(unsigned long n) {
+    return (size_t)(n/2) * (n/2 + 1) + (n % 2) * (n/2 + 1);
+}
+
+void sl2cfoam_factorials_init(unsigned long n) {
+
+    not_thread_safe();
+
+    sl2cfoam_factorials_free();
+
+    FACTORIALS = (mpz_t*)malloc((n+1) * sizeof(mpz_t));
+
+    mpz_init_set_ui(FACTORIALS[0], 1);
+    for (unsigned long i = 1; i <= n; i++) {
+        mpz_init(FACTORIALS[i]);
+        mpz_mul_ui(FACTORIALS[i], FACTORIALS[i-1], i);
+    }
+
+    // half rows of Pascal's triangle, all in a single array
+    BINOMIALS = (mpz_t**)malloc((n+1) * sizeof(mpz_t*));
+    BINOMIALS[0] = (mpz_t*)malloc(row_offset(n+1) * sizeof(mpz_t));
+
+    for (unsigned long i = 0; i <= n; i++) {
+
+        BINOMIALS[i] = BINOMIALS[0] + row_offset(i);
+
+        mpz_init_set_ui(BINOMIALS[i][0], 1);
+        for (unsigned long k = 1; 2*k <= i; k++) {
+
+            // (i k) = (i-1 k-1) + (i-1 k), with (i-1 k) = (i-1 i-1-k)
+            mpz_init(BINOMIALS[i][k]);
+            unsigned long kk = 2*k <= i-1 ? k : i-1-k;
+            mpz_add(BINOMIALS[i][k], BINOMIALS[i-1][k-1], BINOMIALS[i-1][kk]);
+
+        }
+
+    }
+
+    FACTORIALS_NUM = n+1;
+
+}
+
+void sl2cfoam_factorials_free() {
+
+    if (FACTORIALS == NULL) return;
+
+    for (unsigned long i = 0; i < FACTORIALS_NUM; i++) {
+
+        mpz_clear(FACTORIALS[i]);
+
+        for (unsigned long k = 0; 2*k <= i; k++) {
+            mpz_clear(BINOMIALS[i][k]);
+        }
+
+    }
+
+    free(BINOMIALS[0]);
+    free(BINOMIALS);
+    free(FACTORIALS);
+
+    FACTORIALS = NULL;
+    BINOMIALS = NULL;
+    FACTORIALS_NUM = 0;
+
+}
@@ -0,0 +1,97 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SL2CFOAM_FACTORIALS_H__
+#define __SL2CFOAM_FACTORIALS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************/
+
+#include <gmp.h>
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////
+// Tables of exact factorials and binomials of small integers,
+// shared by all threads. They are filled at library
+// initialization up to the maximum spin and are read-only
+// afterwards. Values for larger integers are computed on the fly.
+////////////////////////////////////////////////////////////////
+
+// Number of rows in the tables: 0! ... (NUM-1)!,
+// binomials (n k) with n < NUM and 2k <= n.
+extern unsigned long FACTORIALS_NUM;
+extern mpz_t* FACTORIALS;
+extern mpz_t** BINOMIALS;
+
+// Fills the tables up to n.
+// WARNING: this function is not thread-safe.
+void sl2cfoam_factorials_init(unsigned long n);
+
+// Frees the tables.
+void sl2cfoam_factorials_free();
+
+// Returns n!, from the table if n is small enough,
+// otherwise it is computed in tmp.
+static inline mpz_srcptr sl2cfoam_factorial(unsigned long n, mpz_ptr tmp) {
+
+    if (n < FACTORIALS_NUM) return FACTORIALS[n];
+
+    mpz_fac_ui(tmp, n);
+    return tmp;
+
+}
+
+// Returns the binomial (n k) with 0 <= k <= n, from the table
+// if n is small enough, otherwise it is computed in tmp.
+static inline mpz_srcptr sl2cfoam_binomial(unsigned long n, unsigned long k, mpz_ptr tmp) {
+
+    if (n < FACTORIALS_NUM) return BINOMIALS[n][2*k <= n ? k : n-k];
+
+    mpz_bin_uiui(tmp, n, k);
+    return tmp;
+
+}
+
+// Multiplies op by n!.
+static inline void sl2cfoam_mul_factorial(mpz_ptr rop, mpz_srcptr op, unsigned long n) {
+
+    if (n < FACTORIALS_NUM) {
+        mpz_mul(rop, op, FACTORIALS[n]);
+        return;
+    }
+
+    mpz_t f;
+    mpz_init(f);
+    mpz_fac_ui(f, n);
+    mpz_mul(rop, op, f);
+    mpz_clear(f);
+
+}
+
+/**********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*__SL2CFOAM_FACTORIALS_H__*/
@@ -9,10 +9,285 @@
 // weights as evaluated with 80 decimal digit arithmetic.
 // Adapted from gsl source 
 // (or see https://www.advanpix.com/2011/11/07/gauss-kronrod-quadrature-nodes-weights/)
+// The rules with less than 61 points are computed in quadruple
+// precision with the algorithm of Piessens and Branders, which
+// reproduces the 61-point rule to all the digits given here.
 
 // all values given in (0 1), must double to cover all (-1 1)
 // xgk[1], xgk[3], ... abscissae of the N-point gauss rule. 
 // xgk[0], xgk[2], ... abscissae of Kronrod extension
+// xgk[N] = 0 is a gauss abscissa for N odd (last of wg)
+
+// 15-point rule (N = 7)
+static const __float128 xgk_15[8] =
+{
+    0.991455371120812639206854697526329Q,
+    0.949107912342758524526189684047851Q,
+    0.864864423359769072789712788640926Q,
+    0.741531185599394439863864773280788Q,
+    0.586087235467691130294144838258730Q,
+    0.405845151377397166906606412076961Q,
+    0.207784955007898467600689403773245Q,
+    0.000000000000000000000000000000000Q
+};
+
+static const double wg_15[4] =
+{
+    0.129484966168869693270611432679083,
+    0.279705391489276667901467771423779,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+};
+
+static const double wgk_15[8] =
+{
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189205,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714
+};
+
+// 21-point rule (N = 10)
+static const __float128 xgk_21[11] =
+{
+    0.995657163025808080735527280689003Q,
+    0.973906528517171720077964012084452Q,
+    0.930157491355708226001207180059508Q,
+    0.865063366688984510732096688423493Q,
+    0.780817726586416897063717578345042Q,
+    0.679409568299024406234327365114874Q,
+    0.562757134668604683339000099272694Q,
+    0.433395394129247190799265943165784Q,
+    0.294392862701460198131126603103866Q,
+    0.148874338981631210884826001129720Q,
+    0.000000000000000000000000000000000Q
+};
+
+static const double wg_21[5] =
+{
+    0.066671344308688137593568809893332,
+    0.149451349150580593145776339657697,
+    0.219086362515982043995534934228163,
+    0.269266719309996355091226921569469,
+    0.295524224714752870173892994651338
+};
+
+static const double wgk_21[11] =
+{
+    0.011694638867371874278064396062192,
+    0.032558162307964727478818972459390,
+    0.054755896574351996031381300244580,
+    0.075039674810919952767043140916190,
+    0.093125454583697605535065465083366,
+    0.109387158802297641899210590325805,
+    0.123491976262065851077958109831074,
+    0.134709217311473325928054001771707,
+    0.142775938577060080797094273138717,
+    0.147739104901338491374841515972068,
+    0.149445554002916905664936468389821
+};
+
+// 31-point rule (N = 15)
+static const __float128 xgk_31[16] =
+{
+    0.998002298693397060285172840152271Q,
+    0.987992518020485428489565718586613Q,
+    0.967739075679139134257347978784337Q,
+    0.937273392400705904307758947710210Q,
+    0.897264532344081900882509656454496Q,
+    0.848206583410427216200648320774217Q,
+    0.790418501442465932967649294817947Q,
+    0.724417731360170047416186054613938Q,
+    0.650996741297416970533735895313275Q,
+    0.570972172608538847537226737253911Q,
+    0.485081863640239680693655740232351Q,
+    0.394151347077563369897207370981045Q,
+    0.299180007153168812166780024266389Q,
+    0.201194093997434522300628303394596Q,
+    0.101142066918717499027074231447392Q,
+    0.000000000000000000000000000000000Q
+};
+
+static const double wg_31[8] =
+{
+    0.030753241996117268354628393577204,
+    0.070366047488108124709267416450667,
+    0.107159220467171935011869546685869,
+    0.139570677926154314447804794511028,
+    0.166269205816993933553200860481209,
+    0.186161000015562211026800561866423,
+    0.198431485327111576456118326443839,
+    0.202578241925561272880620199967519
+};
+
+static const double wgk_31[16] =
+{
+    0.005377479872923348987792051430128,
+    0.015007947329316122538374763075807,
+    0.025460847326715320186874001019653,
+    0.035346360791375846222037948478360,
+    0.044589751324764876608227299373280,
+    0.053481524690928087265343147239430,
+    0.062009567800670640285139230960803,
+    0.069854121318728258709520077099147,
+    0.076849680757720378894432777482659,
+    0.083080502823133021038289247286104,
+    0.088564443056211770647275443693774,
+    0.093126598170825321225486872747346,
+    0.096642726983623678505179907627589,
+    0.099173598721791959332393173484603,
+    0.100769845523875595044946662617570,
+    0.101330007014791549017374792767492
+};
+
+// 41-point rule (N = 20)
+static const __float128 xgk_41[21] =
+{
+    0.998859031588277663838315576545863Q,
+    0.993128599185094924786122388471320Q,
+    0.981507877450250259193342994720217Q,
+    0.963971927277913791267666131197277Q,
+    0.940822633831754753519982722212443Q,
+    0.912234428251325905867752441203298Q,
+    0.878276811252281976077442995113078Q,
+    0.839116971822218823394529061701521Q,
+    0.795041428837551198350638833272788Q,
+    0.746331906460150792614305070355642Q,
+    0.693237656334751384805490711845932Q,
+    0.636053680726515025452836696226286Q,
+    0.575140446819710315342946036586425Q,
+    0.510867001950827098004364050955251Q,
+    0.443593175238725103199992213492640Q,
+    0.373706088715419560672548177024927Q,
+    0.301627868114913004320555356858592Q,
+    0.227785851141645078080496195368575Q,
+    0.152605465240922675505220241022677Q,
+    0.076526521133497333754640409398838Q,
+    0.000000000000000000000000000000000Q
+};
+
+static const double wg_41[10] =
+{
+    0.017614007139152118311861962351852,
+    0.040601429800386941331039952274932,
+    0.062672048334109063569506535187041,
+    0.083276741576704748724758143222046,
+    0.101930119817240435036750135480350,
+    0.118194531961518417312377377711382,
+    0.131688638449176626898494499748163,
+    0.142096109318382051329298325067165,
+    0.149172986472603746787828737001969,
+    0.152753387130725850698084331955098
+};
+
+static const double wgk_41[21] =
+{
+    0.003073583718520531501218293246031,
+    0.008600269855642942198661787950102,
+    0.014626169256971252983787960308868,
+    0.020388373461266523598010231432754,
+    0.025882133604951158834505067096153,
+    0.031287306777032798958543119323800,
+    0.036600169758200798030557240707211,
+    0.041668873327973686263788305936895,
+    0.046434821867497674720231880926108,
+    0.050944573923728691932707670050345,
+    0.055195105348285994744832372419777,
+    0.059111400880639572374967220648594,
+    0.062653237554781168025870122174255,
+    0.065834597133618422111563556969398,
+    0.068648672928521619345623411885368,
+    0.071054423553444068305790361723210,
+    0.073030690332786667495189417658913,
+    0.074582875400499188986581418362487,
+    0.075704497684556674659542775376617,
+    0.076377867672080736705502835038061,
+    0.076600711917999656445049901530102
+};
+
+// 51-point rule (N = 25)
+static const __float128 xgk_51[26] =
+{
+    0.999262104992609834193457486540341Q,
+    0.995556969790498097908784946893902Q,
+    0.988035794534077247637331014577406Q,
+    0.976663921459517511498315386479594Q,
+    0.961614986425842512418130033660167Q,
+    0.942974571228974339414011169658471Q,
+    0.920747115281701561746346084546331Q,
+    0.894991997878275368851042006782805Q,
+    0.865847065293275595448996969588340Q,
+    0.833442628760834001421021108693570Q,
+    0.797873797998500059410410904994307Q,
+    0.759259263037357630577282865204361Q,
+    0.717766406813084388186654079773298Q,
+    0.673566368473468364485120633247622Q,
+    0.626810099010317412788122681624518Q,
+    0.577662930241222967723689841612654Q,
+    0.526325284334719182599623778158010Q,
+    0.473002731445714960522182115009192Q,
+    0.417885382193037748851814394594573Q,
+    0.361172305809387837735821730127641Q,
+    0.303089538931107830167478909980339Q,
+    0.243866883720988432045190362797452Q,
+    0.183718939421048892015969888759528Q,
+    0.122864692610710396387359818808037Q,
+    0.061544483005685078886546392366797Q,
+    0.000000000000000000000000000000000Q
+};
+
+static const double wg_51[13] =
+{
+    0.011393798501026287947902964113236,
+    0.026354986615032137261901815295299,
+    0.040939156701306312655623487711647,
+    0.054904695975835191925936891540473,
+    0.068038333812356917207187185656708,
+    0.080140700335001018013234959669111,
+    0.091028261982963649811497220702892,
+    0.100535949067050644202206890392686,
+    0.108519624474263653116093957050116,
+    0.114858259145711648339325545869556,
+    0.119455763535784772228178126512901,
+    0.122242442990310041688959518945852,
+    0.123176053726715451203902873079050
+};
+
+static const double wgk_51[26] =
+{
+    0.001987383892330315926507851882843,
+    0.005561932135356713758040236901067,
+    0.009473973386174151607207710523655,
+    0.013236229195571674813656405846976,
+    0.016847817709128298231516667536336,
+    0.020435371145882835456568292235940,
+    0.024009945606953216220092489164881,
+    0.027475317587851737802948455517811,
+    0.030792300167387488891109020215229,
+    0.034002130274329337836748795229551,
+    0.037116271483415543560330625367620,
+    0.040083825504032382074839284467076,
+    0.042872845020170049476895792439495,
+    0.045502913049921788909870584752660,
+    0.047982537138836713906392255756915,
+    0.050277679080715671963325259433440,
+    0.052362885806407475864366712137873,
+    0.054251129888545490144543370459875,
+    0.055950811220412317308240686382747,
+    0.057437116361567832853582693939506,
+    0.058689680022394207961974175856788,
+    0.059720340324174059979099291932562,
+    0.060539455376045862945360267517565,
+    0.061128509717053048305859030416293,
+    0.061471189871425316661544131965264,
+    0.061580818067832935078759824240065
+};
+
+// 61-point rule (N = 30)
 static const __float128 xgk_61[31] =
 {
     0.999484410050490637571325895705811Q,
@@ -104,16 +379,47 @@ static const double wgk_61[31] =
     0.051494729429451567558340433647099
 };
 
+// Gauss-Kronrod rule with given number of points (2N+1).
+typedef struct gk_rule {
+    int points;
+    const __float128* xgk;
+    const double* wgk;
+    const double* wg;
+} gk_rule;
+
+static const gk_rule gk_rules[] = {
+    { 15, xgk_15, wgk_15, wg_15 },
+    { 21, xgk_21, wgk_21, wg_21 },
+    { 31, xgk_31, wgk_31, wg_31 },
+    { 41, xgk_41, wgk_41, wg_41 },
+    { 51, xgk_51, wgk_51, wg_51 },
+    { 61, xgk_61, wgk_61, wg_61 }
+};
+
+#define GK_RULES ((int)(sizeof(gk_rules) / sizeof(gk_rule)))
+
+static const gk_rule* gk_rule_get(int points) {
+
+    for (int r = 0; r < GK_RULES; r++) {
+        if (gk_rules[r].points == points) return &gk_rules[r];
+    }
+
+    error("no Gauss-Kronrod rule with %d points", points);
+
+}
+
 // Compute the abscissae for the Gauss-Kronrod method.
 // NB: the same pattern is then used in gk_sum
-static inline void gk_abscissae(__float128 a, __float128 b, __float128* xgk) {
+static inline void gk_abscissae(const gk_rule* rule, __float128 a, __float128 b, __float128* xgk) {
 
-    const __float128* xgk_std = xgk_61;
+    const __float128* xgk_std = rule->xgk;
+    const int N = DIV2(rule->points-1);
 
     const __float128 center = 0.5Q * (b + a);
     const __float128 hl = 0.5Q * (b - a);
 
-    for (int i = 0; i < DIV2(GK_POINTS-1); i += 2) {
+    int i;
+    for (i = 0; i + 1 < N; i += 2) {
 
         // Gauss points
         xgk[2*i] = center + hl * xgk_std[i+1];
@@ -124,19 +430,28 @@ static inline void gk_abscissae(__float128 a, __float128 b, __float128* xgk) {
         xgk[2*i+3] = center - hl * xgk_std[i];
 
     }
-    xgk[GK_POINTS-1] = center;
+
+    // for N odd the last Kronrod points are left
+    if (i < N) {
+        xgk[2*i] = center + hl * xgk_std[i];
+        xgk[2*i+1] = center - hl * xgk_std[i];
+    }
+
+    xgk[rule->points-1] = center;
 
 }
 
 // Compute the weights (on a piece of the grid) for the 
 // Gauss and Gauss-Kronrod methods
 // NB: the same pattern is then used in gk_sum
-static inline void gk_weigths(__float128 a, __float128 b, double* wgk) {
+static inline void gk_weigths(const gk_rule* rule, __float128 a, __float128 b, double* wgk) {
 
-    const double* wgk_std = wgk_61;
+    const double* wgk_std = rule->wgk;
+    const int N = DIV2(rule->points-1);
     const double hl = 0.5 * (double)(b - a);
 
-    for (int i = 0; i < DIV2(GK_POINTS-1); i += 2) {
+    int i;
+    for (i = 0; i + 1 < N; i += 2) {
 
         // Gauss-Kronrod points
         wgk[2*i]   = wgk_std[i+1] * hl;
@@ -145,16 +460,24 @@ static inline void gk_weigths(__float128 a, __float128 b, double* wgk) {
         wgk[2*i+3] = wgk_std[i]   * hl;
 
     }
-    wgk[GK_POINTS-1] = wgk_std[DIV2(GK_POINTS-1)] * hl;
+
+    if (i < N) {
+        wgk[2*i]   = wgk_std[i] * hl;
+        wgk[2*i+1] = wgk_std[i] * hl;
+    }
+
+    wgk[rule->points-1] = wgk_std[N] * hl;
 
 }
 
-static inline void gk_weigths_gauss(__float128 a, __float128 b, double* wg) {
+static inline void gk_weigths_gauss(const gk_rule* rule, __float128 a, __float128 b, double* wg) {
 
-    const double* wg_std = wg_61;
+    const double* wg_std = rule->wg;
+    const int N = DIV2(rule->points-1);
     const double hl = 0.5 * (double)(b - a);
 
-    for (int i = 0; i < DIV2(GK_POINTS-1); i += 2) {
+    int i;
+    for (i = 0; i + 1 < N; i += 2) {
 
         // Gauss points
         wg[2*i]   = wg_std[DIV2(i)] * hl;
@@ -163,7 +486,14 @@ static inline void gk_weigths_gauss(__float128 a, __float128 b, double* wg) {
         wg[2*i+3] = 0.0;
 
     }
-    wg[GK_POINTS-1] = 0.0;
+
+    if (i < N) {
+        wg[2*i]   = 0.0;
+        wg[2*i+1] = 0.0;
+    }
+
+    // the center is a Gauss point for N odd
+    wg[rule->points-1] = (N % 2 == 1 ? wg_std[DIV2(N)] * hl : 0.0);
 
 }
 
@@ -201,49 +531,182 @@ __float128* sl2cfoam_grid_harmonic(int intervals) {
 
 }
 
-__float128* sl2cfoam_gk_grid_abscissae(int intervals, __float128* grid) {
+__float128* sl2cfoam_grid_bisect(int intervals, __float128* grid, bool* bisect) {
+
+    int num = intervals;
+    for (int i = 0; i < intervals; i++) {
+        if (bisect[i]) num++;
+    }
+
+    __float128* grid_new;
+    grid_new = (__float128*) malloc((num+1) * sizeof(__float128));
+
+    int j = 0;
+    for (int i = 0; i < intervals; i++) {
+
+        grid_new[j++] = grid[i];
+        if (bisect[i]) {
+            grid_new[j++] = (grid[i] + grid[i+1]) / 2;
+        }
+
+    }
+    grid_new[num] = grid[intervals];
+
+    return grid_new;
+
+}
+
+__float128* sl2cfoam_gk_grid_abscissae(int intervals, int points, __float128* grid) {
+
+    const gk_rule* rule = gk_rule_get(points);
 
     __float128* xs;
-    xs = (__float128*) malloc(GK_POINTS * intervals * sizeof(__float128));
+    xs = (__float128*) malloc(points * intervals * sizeof(__float128));
 
     for (int i = 0; i < intervals; i++) {
-        gk_abscissae(grid[i], grid[i+1], xs + GK_POINTS*i);
+        gk_abscissae(rule, grid[i], grid[i+1], xs + points*i);
     }
 
     return xs;
 
 }
 
-double* sl2cfoam_gk_grid_weights(int intervals, __float128* grid) {
+double* sl2cfoam_gk_grid_weights(int intervals, int points, __float128* grid) {
+
+    const gk_rule* rule = gk_rule_get(points);
 
     double* ws;
-    ws = (double*) malloc(GK_POINTS * intervals * sizeof(double));
+    ws = (double*) malloc(points * intervals * sizeof(double));
 
     for (int i = 0; i < intervals; i++) {
-        gk_weigths(grid[i], grid[i+1], ws + GK_POINTS*i);
+        gk_weigths(rule, grid[i], grid[i+1], ws + points*i);
     }
 
     return ws;
 
 }
 
-double* sl2cfoam_gk_grid_weights_gauss(int intervals, __float128* grid) {
+double* sl2cfoam_gk_grid_weights_gauss(int intervals, int points, __float128* grid) {
+
+    const gk_rule* rule = gk_rule_get(points);
 
     double* ws;
-    ws = (double*) malloc(GK_POINTS * intervals * sizeof(double));
+    ws = (double*) malloc(points * intervals * sizeof(double));
 
     for (int i = 0; i < intervals; i++) {
-        gk_weigths_gauss(grid[i], grid[i+1], ws + GK_POINTS*i);
+        gk_weigths_gauss(rule, grid[i], grid[i+1], ws + points*i);
+    }
+
+    return ws;
+
+}
+
+// Index k of the node cos(k pi / N) of the level of the nested rule
+// for the i-th point of an interval (see sl2cfoam_nested_grid_abscissae).
+// Points are sorted by the level at which they are added.
+static int nested_node(int level, int i) {
+
+    int n0 = NESTED_POINTS(0) + 1;
+
+    // nodes of level 0
+    if (i < n0 - 1) return (i + 1) << level;
+    i -= n0 - 1;
+
+    // odd nodes added at level s
+    for (int s = 1; ; s++) {
+        int added = n0 << (s - 1);
+        if (i < added) return (2 * i + 1) << (level - s);
+        i -= added;
+    }
+
+}
+
+// Weight of the node cos(k pi / N) of Fejer's second rule
+// with N-1 points on (-1 1).
+static __float128 fejer2_weight(int N, int k) {
+
+    __float128 theta = M_PIq * k / N;
+
+    __float128 sum = 0.0Q;
+    for (int j = 1; j <= N / 2; j++) {
+        sum += sinq((2 * j - 1) * theta) / (2 * j - 1);
+    }
+
+    return 4.0Q * sinq(theta) * sum / N;
+
+}
+
+__float128* sl2cfoam_nested_grid_abscissae(int intervals, __float128* grid, int level) {
+
+    int points = NESTED_POINTS(level);
+    int N = points + 1;
+
+    __float128* xs;
+    xs = (__float128*) malloc(points * intervals * sizeof(__float128));
+
+    for (int k = 0; k < intervals; k++) {
+
+        __float128 a = grid[k];
+        __float128 hl = (grid[k+1] - grid[k]) / 2.0Q;
+
+        for (int i = 0; i < points; i++) {
+            xs[points*k + i] = a + hl * (1.0Q - cosq(M_PIq * nested_node(level, i) / N));
+        }
+
+    }
+
+    return xs;
+
+}
+
+double* sl2cfoam_nested_grid_weights(int intervals, __float128* grid, int level, int level_rule) {
+
+    if (level_rule < 0 || level_rule > level) {
+        error("wrong level of nested rule");
+    }
+
+    int points = NESTED_POINTS(level);
+
+    // the rule of level_rule has nodes k / 2^(level - level_rule)
+    int N_rule = NESTED_POINTS(level_rule) + 1;
+    int shift = level - level_rule;
+
+    __float128* wr = (__float128*) malloc(N_rule * sizeof(__float128));
+    for (int k = 1; k < N_rule; k++) {
+        wr[k] = fejer2_weight(N_rule, k);
+    }
+
+    double* ws;
+    ws = (double*) malloc(points * intervals * sizeof(double));
+
+    for (int k = 0; k < intervals; k++) {
+
+        __float128 hl = (grid[k+1] - grid[k]) / 2.0Q;
+
+        for (int i = 0; i < points; i++) {
+
+            int node = nested_node(level, i);
+
+            if (node % (1 << shift) == 0) {
+                ws[points*k + i] = (double)(hl * wr[node >> shift]);
+            } else {
+                ws[points*k + i] = 0.0;
+            }
+
+        }
+
     }
 
+    free(wr);
+
     return ws;
 
 }
 
-double sl2cfoam_gk_grid(int intervals, double* ys, double* ms, 
+double sl2cfoam_gk_grid(int intervals, int points, double* ys, double* ms, 
                         double* wgks, double* wgs, double* abserr) {
 
-    int nxs = GK_POINTS * intervals;
+    int nxs = points * intervals;
     
     long double res_kronrod = 0.0;
 
@@ -267,3 +730,18 @@ double sl2cfoam_gk_grid(int intervals, double* ys, double* ms,
     return (double)res_kronrod;
 
 }
+
+void sl2cfoam_gk_grid_errors(int intervals, int points, double* ys, double* ms, 
+                             double* wgks, double* wgs, double* errs) {
+
+    for (int k = 0; k < intervals; k++) {
+
+        long double err = 0.0;
+        for (int i = points * k; i < points * (k+1); i++) {
+            err += (long double)(ys[i] * ms[i] * (wgks[i] - wgs[i]));
+        }
+        errs[k] = (double)fabsl(err);
+
+    }
+
+}
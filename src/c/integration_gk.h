@@ -32,8 +32,9 @@ extern "C" {
 
 
 ////////////////////////////////////////////////////////////////
-// Fixed quadrature using 61-point gauss-konrod method on 
-// subintervals of (0 1) defined by a grid.
+// Fixed quadrature using gauss-konrod method on subintervals
+// of (0 1) defined by a grid. The rules with 15, 21, 31, 41, 51
+// and 61 points (N-2N+1) are available.
 ////////////////////////////////////////////////////////////////
 
 // Number of Gauss-Kronrod points, default rule: 30-61
@@ -50,28 +51,68 @@ __float128* sl2cfoam_grid_harmonic(int intervals);
 // Computes a uniform grid in (0 1).
 __float128* sl2cfoam_grid_uniform(int intervals);
 
-// Computes all the Gauss-Kronrod abscissae for the subintervals
-// of (0 1) defined by the given grid.
-// The number of points is GK_POINTS * intervals
-// Default rule uses 61 GK points.
-__float128* sl2cfoam_gk_grid_abscissae(int intervals, __float128* grid);
+// Computes the grid obtained by bisecting the intervals
+// of the given grid with bisect[i] set.
+// The number of intervals of the result is intervals plus
+// the number of intervals bisected.
+__float128* sl2cfoam_grid_bisect(int intervals, __float128* grid, bool* bisect);
+
+// Computes all the abscissae of the Gauss-Kronrod rule with given
+// number of points for the subintervals of (0 1) defined by the given grid.
+// The number of points is points * intervals.
+// Fails if there is no rule with the given number of points.
+__float128* sl2cfoam_gk_grid_abscissae(int intervals, int points, __float128* grid);
 
 // Computes all the Gauss-Kronrod weights for the subintervals
 // of (0 1) defined by the given grid.
-double* sl2cfoam_gk_grid_weights(int intervals, __float128* grid);
+double* sl2cfoam_gk_grid_weights(int intervals, int points, __float128* grid);
 
 // Computes all the (plain) Gauss weights  for the subintervals
 // of (0 1) defined by the given grid.
-double* sl2cfoam_gk_grid_weights_gauss(int intervals, __float128* grid);
+double* sl2cfoam_gk_grid_weights_gauss(int intervals, int points, __float128* grid);
 
-// Computes the GK sum on a given grid.
+// Computes the GK sum on a given grid with given number of
+// points per interval (the points of the Gauss-Kronrod rule).
 // Inputs are function evaluations, measures and weigths.
 // Returns the result of Kronrod extension and optionally
 // an absolute error given by the difference with the Gauss sum
 // (for this the wgs parameter must be not NULL);
-double sl2cfoam_gk_grid(int intervals, double* ys, double* ms, 
+// Works the same for the nested rules below, with the weights
+// of the finer and of the coarser rule in place of wgks and wgs.
+double sl2cfoam_gk_grid(int intervals, int points, double* ys, double* ms, 
                         double* wgks, double* wgs, double* abserr);
 
+// Computes the absolute errors of the GK sum on each interval
+// of a given grid (the differences with the Gauss sums) in errs.
+void sl2cfoam_gk_grid_errors(int intervals, int points, double* ys, double* ms, 
+                             double* wgks, double* wgs, double* errs);
+
+
+////////////////////////////////////////////////////////////////
+// Nested quadrature on subintervals of (0 1) defined by a grid,
+// using Fejer's second rule (Clenshaw-Curtis without the endpoints)
+// with nodes cos(k pi / N) on each interval. The rule of level l
+// has N = 32 * 2^l, so each level adds the odd nodes to the
+// previous one. On each interval the points are sorted by the level
+// at which they are added: the abscissae of a level are the first
+// points of each interval of any finer level, and the functions
+// computed there can be reused when raising the level.
+// The error is estimated by the difference with the previous level.
+////////////////////////////////////////////////////////////////
+
+// Number of points per interval of the nested rule of given level.
+#define NESTED_POINTS(level) ((32 << (level)) - 1)
+
+// Computes all the abscissae of the nested rule of given level
+// for the subintervals of (0 1) defined by the given grid.
+// The number of points is NESTED_POINTS(level) * intervals.
+__float128* sl2cfoam_nested_grid_abscissae(int intervals, __float128* grid, int level);
+
+// Computes the weights of the nested rule of level level_rule <= level
+// at the abscissae of the rule of given level (0 at the points
+// not in the coarser rule).
+double* sl2cfoam_nested_grid_weights(int intervals, __float128* grid, int level, int level_rule);
+
 /**********************************************************************/
 
 #ifdef __cplusplus
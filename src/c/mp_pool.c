@@ -0,0 +1,215 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include <mpfr.h>
+#include <mpc.h>
+
+#include "common.h"
+#include "error.h"
+#include "mp_pool.h"
+
+// numbers in a chunk
+#define MP_POOL_CHUNK 64
+
+// Stack of numbers of one kind and precision class.
+// A chunk holds MP_POOL_CHUNK structs followed by their limbs.
+typedef struct mp_stack {
+    size_t used;
+    size_t num;
+    char** chunks;
+} mp_stack;
+
+typedef struct mp_class {
+    mp_stack fr;
+    mp_stack c;
+} mp_class;
+
+typedef struct mp_pool {
+    mp_class* classes;  // indexed by the number of limbs
+    size_t classes_num;
+    int* log;           // borrowed stacks in order (2 * class + kind)
+    size_t log_num;
+    size_t log_cap;
+} mp_pool;
+
+static _Thread_local mp_pool pool;
+
+// key for freeing the pool when its thread exits
+// (the threads of nested OpenMP regions are not reused)
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+static void pool_exit(void* unused) {
+    (void)unused;
+    sl2cfoam_mp_pool_free();
+}
+
+static void pool_key_create() {
+    pthread_key_create(&pool_key, pool_exit);
+}
+
+static inline size_t limbs_of(mpfr_prec_t prec) {
+    return (size_t)((prec + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS);
+}
+
+// returns a free slot of the stack, structs of given size
+// with nlimbs limbs each
+static char* stack_push(mp_stack* s, size_t struct_size, size_t nlimbs, mp_limb_t** limbs) {
+
+    if (s->used == s->num) {
+
+        size_t nc = s->num / MP_POOL_CHUNK;
+        s->chunks = (char**)realloc(s->chunks, (nc + 1) * sizeof(char*));
+
+        char* chunk = (char*)malloc(MP_POOL_CHUNK * (struct_size + nlimbs * sizeof(mp_limb_t)));
+        if (chunk == NULL) error("error allocating multiprecision pool");
+
+        s->chunks[nc] = chunk;
+        s->num += MP_POOL_CHUNK;
+
+    }
+
+    char* chunk = s->chunks[s->used / MP_POOL_CHUNK];
+    size_t k = s->used % MP_POOL_CHUNK;
+
+    *limbs = (mp_limb_t*)(chunk + MP_POOL_CHUNK * struct_size) + k * nlimbs;
+    s->used++;
+
+    return chunk + k * struct_size;
+
+}
+
+static mp_class* pool_class(size_t nlimbs, int kind) {
+
+    // first number borrowed by this thread
+    if (pool.classes == NULL) {
+        pthread_once(&pool_key_once, pool_key_create);
+        pthread_setspecific(pool_key, &pool);
+    }
+
+    if (nlimbs >= pool.classes_num) {
+
+        size_t num = nlimbs + 1;
+        pool.classes = (mp_class*)realloc(pool.classes, num * sizeof(mp_class));
+        memset(pool.classes + pool.classes_num, 0, (num - pool.classes_num) * sizeof(mp_class));
+        pool.classes_num = num;
+
+    }
+
+    if (pool.log_num == pool.log_cap) {
+        pool.log_cap = pool.log_cap > 0 ? 2 * pool.log_cap : 256;
+        pool.log = (int*)realloc(pool.log, pool.log_cap * sizeof(int));
+    }
+
+    pool.log[pool.log_num++] = 2 * (int)nlimbs + kind;
+
+    return &pool.classes[nlimbs];
+
+}
+
+static inline void custom_init(mpfr_ptr x, mpfr_prec_t prec, mp_limb_t* limbs) {
+    mpfr_custom_init(limbs, prec);
+    mpfr_custom_init_set(x, MPFR_NAN_KIND, 0, prec, limbs);
+}
+
+mp_pool_mark sl2cfoam_mp_mark() {
+    return pool.log_num;
+}
+
+void sl2cfoam_mp_release(mp_pool_mark mark) {
+
+    while (pool.log_num > mark) {
+
+        int e = pool.log[--pool.log_num];
+        mp_class* cl = &pool.classes[e / 2];
+
+        if (e % 2 == 0) {
+            cl->fr.used--;
+        } else {
+            cl->c.used--;
+        }
+
+    }
+
+}
+
+mpfr_ptr sl2cfoam_mpfr_borrow(mpfr_prec_t prec) {
+
+    size_t nlimbs = limbs_of(prec);
+    mp_class* cl = pool_class(nlimbs, 0);
+
+    mp_limb_t* limbs;
+    mpfr_ptr x = (mpfr_ptr)stack_push(&cl->fr, sizeof(__mpfr_struct), nlimbs, &limbs);
+    custom_init(x, prec, limbs);
+
+    return x;
+
+}
+
+mpc_ptr sl2cfoam_mpc_borrow(mpfr_prec_t prec) {
+
+    size_t nlimbs = limbs_of(prec);
+    mp_class* cl = pool_class(nlimbs, 1);
+
+    mp_limb_t* limbs;
+    mpc_ptr z = (mpc_ptr)stack_push(&cl->c, sizeof(__mpc_struct), 2 * nlimbs, &limbs);
+    custom_init(mpc_realref(z), prec, limbs);
+    custom_init(mpc_imagref(z), prec, limbs + nlimbs);
+
+    return z;
+
+}
+
+void sl2cfoam_mpfr_borrow_array(mpfr_ptr rop[], size_t n, mpfr_prec_t prec) {
+    for (size_t i = 0; i < n; i++) {
+        rop[i] = sl2cfoam_mpfr_borrow(prec);
+    }
+}
+
+void sl2cfoam_mpc_borrow_array(mpc_ptr rop[], size_t n, mpfr_prec_t prec) {
+    for (size_t i = 0; i < n; i++) {
+        rop[i] = sl2cfoam_mpc_borrow(prec);
+    }
+}
+
+static void stack_free(mp_stack* s) {
+
+    for (size_t i = 0; i < s->num / MP_POOL_CHUNK; i++) {
+        free(s->chunks[i]);
+    }
+    free(s->chunks);
+
+}
+
+void sl2cfoam_mp_pool_free() {
+
+    for (size_t i = 0; i < pool.classes_num; i++) {
+        stack_free(&pool.classes[i].fr);
+        stack_free(&pool.classes[i].c);
+    }
+
+    free(pool.classes);
+    free(pool.log);
+
+    memset(&pool, 0, sizeof(mp_pool));
+
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright 2020 Francesco Gozzini < gozzini AT cpt.univ-mrs.fr >
+ *
+ *  This file is part of SL2CFOAM-NEXT.
+ *
+ *  SL2CFOAM-NEXT is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  SL2CFOAM-NEXT is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with SL2CFOAM-NEXT. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SL2CFOAM_MP_POOL_H__
+#define __SL2CFOAM_MP_POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**********************************************************************/
+
+#include <mpc.h>
+
+#include "common.h"
+
+////////////////////////////////////////////////////////////////
+// Pool of multiprecision numbers.
+//
+// Each thread owns a pool of mpfr and mpc numbers whose limbs
+// are stored in bulk chunks, grouped by precision class (the
+// number of limbs). Numbers are borrowed with a given precision
+// and given back by going back to a mark, as for the b4 arenas.
+// Borrowing only resets the precision of a number, so that
+// after the first calls no memory is allocated.
+//
+// Borrowed numbers are set to NaN as with mpfr_init2 and must
+// not be cleared or have their precision changed.
+////////////////////////////////////////////////////////////////
+
+// Position in the pool of the calling thread to go back to.
+typedef size_t mp_pool_mark;
+
+// Returns the current position of the pool of the calling thread.
+mp_pool_mark sl2cfoam_mp_mark();
+
+// Gives back all the numbers borrowed after the given mark.
+void sl2cfoam_mp_release(mp_pool_mark mark);
+
+// Borrows a number with given precision.
+mpfr_ptr sl2cfoam_mpfr_borrow(mpfr_prec_t prec);
+mpc_ptr sl2cfoam_mpc_borrow(mpfr_prec_t prec);
+
+// Borrows n numbers with given precision.
+void sl2cfoam_mpfr_borrow_array(mpfr_ptr rop[], size_t n, mpfr_prec_t prec);
+void sl2cfoam_mpc_borrow_array(mpc_ptr rop[], size_t n, mpfr_prec_t prec);
+
+// Frees the pool of the calling thread.
+// The pools are also freed when their threads exit.
+void sl2cfoam_mp_pool_free();
+
+/**********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif/*__SL2CFOAM_MP_POOL_H__*/
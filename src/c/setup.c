@@ -35,6 +35,11 @@
 #include "utils.h"
 #include "error.h"
 #include "mpi_utils.h"
+#include "dsmall_cache.h"
+#include "dsmall_integral.h"
+#include "mp_pool.h"
+#include "factorials.h"
+#include "blas_wrapper.h"
 
 
 #ifdef USE_MPI
@@ -64,10 +69,34 @@ void sl2cfoam_init_conf(char* root_folder, double Immirzi, struct sl2cfoam_confi
     // initialize wigxjpf
     wig_table_init(conf->max_two_spin, 6);
 
+    // exact factorials for the dsmall coefficients
+    sl2cfoam_factorials_init(conf->max_two_spin);
+
 
     // enable OMP parallelization by default
     OMP_PARALLELIZE = true;
 
+    // dsmall functions are not stored on disk by default
+    DSMALL_STORE = false;
+
+    // exact dsmall functions for all the spins by default
+    DSMALL_INTEGRAL_TWO_L = DSMALL_INTEGRAL_TWO_L_DEFAULT;
+
+    // per-tuple integration grids for boosters by default
+    BOOSTERS_SHARED_GRID = false;
+
+    // matrix products for b4 integrals by default
+    sl2cfoam_set_b4_integration(SL2CFOAM_B4_INTEGRATION_GEMM);
+
+    // cheaper b4 algorithm by default
+    sl2cfoam_set_b4_engine(SL2CFOAM_B4_ENGINE_AUTO);
+
+    // number of integration intervals fixed by accuracy by default
+    sl2cfoam_set_b4_tolerance(0);
+
+    // Gauss-Kronrod rules for b4 integrals by default
+    sl2cfoam_set_b4_quadrature(SL2CFOAM_B4_QUADRATURE_GK);
+
     // no nested parallelism
     omp_set_max_active_levels(1);
 
@@ -83,7 +112,7 @@ void sl2cfoam_init_conf(char* root_folder, double Immirzi, struct sl2cfoam_confi
     #elif USE_SYSBLAS
 
     #ifdef OPENBLAS_THREAD
-    openblas_set_num_threads(1)
+    openblas_set_num_threads(1);
     #endif
 
     #endif
@@ -123,10 +152,30 @@ void sl2cfoam_free() {
     // wigxjpf
     wig_table_free();
 
+    // cached dsmalls
+    sl2cfoam_dsmall_cache_clear();
+
+    // factorials
+    sl2cfoam_factorials_free();
+
+    // multiprecision numbers of all the threads
+    // (the threads of the OpenMP regions are kept between them)
+    #ifdef USE_OMP
+    #pragma omp parallel
+    #endif
+    sl2cfoam_mp_pool_free();
+
     // free paths
     free(DATA_ROOT);
     free(DIR_BOOSTERS);
     free(DIR_AMPLS);
+    free(DIR_DSMALL);
+
+    // for initializing again
+    DATA_ROOT = NULL;
+    DIR_BOOSTERS = NULL;
+    DIR_AMPLS = NULL;
+    DIR_DSMALL = NULL;
 
     #ifdef USE_MPI
 
@@ -32,6 +32,9 @@
 
 #include "utils.h"
 #include "error.h"
+#include "verb.h"
+#include "dsmall_cache.h"
+#include "dsmall_integral.h"
 
 // root folder
 char* DATA_ROOT;
@@ -43,6 +46,7 @@ struct sl2cfoam_config CONFIG;
 double IMMIRZI;
 char* DIR_BOOSTERS;
 char* DIR_AMPLS;
+char* DIR_DSMALL;
 
 // global verbosity level
 int VERBOSITY;
@@ -54,6 +58,21 @@ int MPBITS;
 // flag to enable or disable OpenMP parallelization
 bool OMP_PARALLELIZE;
 
+// flag to use a single integration grid for each booster tensor
+bool BOOSTERS_SHARED_GRID;
+
+// method for the b4 integrals
+int B4_INTEGRATION;
+
+// algorithm for the b4 coefficients
+int B4_ENGINE;
+
+// target tolerance for the b4 integrals
+double B4_TOLERANCE;
+
+// quadrature rule for the b4 integrals
+int B4_QUADRATURE;
+
 void sl2cfoam_set_verbosity(int verbosity) {
 
     not_thread_safe();
@@ -111,15 +130,17 @@ void sl2cfoam_set_Immirzi(double Immirzi) {
     // update/create folder structure
 
     int len = strlen(DATA_ROOT) + 256;
-    if (DIR_BOOSTERS == NULL || DIR_AMPLS == NULL) {
+    if (DIR_BOOSTERS == NULL || DIR_AMPLS == NULL || DIR_DSMALL == NULL) {
 
         DIR_BOOSTERS = (char*)malloc(len*sizeof(char));
         DIR_AMPLS = (char*)malloc(len*sizeof(char));
+        DIR_DSMALL = (char*)malloc(len*sizeof(char));
 
     }
 
     strcpy(DIR_BOOSTERS, DATA_ROOT);
     strcpy(DIR_AMPLS, DATA_ROOT);
+    strcpy(DIR_DSMALL, DATA_ROOT);
 
     char tmp[256];
 
@@ -129,6 +150,9 @@ void sl2cfoam_set_Immirzi(double Immirzi) {
     sprintf(tmp, "/vertex/immirzi_%.3f/amplitudes", IMMIRZI);
     strcat(DIR_AMPLS, tmp);
 
+    sprintf(tmp, "/vertex/immirzi_%.3f/dsmall", IMMIRZI);
+    strcat(DIR_DSMALL, tmp);
+
     // check/create directories
 
 MPI_MASTERONLY_START
@@ -156,6 +180,10 @@ MPI_MASTERONLY_START
         if (errno != EEXIST) { error("cannot create amplitudes directory: %s", strerror(errno)); }
     }
 
+    if (mkdir(DIR_DSMALL, 0755) == -1) {
+        if (errno != EEXIST) { error("cannot create dsmall directory: %s %s", DIR_DSMALL, strerror(errno)); }
+    }
+
 MPI_MASTERONLY_END
 
 }
@@ -190,6 +218,118 @@ bool sl2cfoam_get_OMP() {
     return OMP_PARALLELIZE;
 }
 
+void sl2cfoam_set_dsmall_cache(size_t MB) {
+
+    not_thread_safe();
+    sl2cfoam_dsmall_cache_clear();
+    DSMALL_CACHE_MB = MB;
+
+}
+
+void sl2cfoam_set_dsmall_store(bool enable) {
+
+    not_thread_safe();
+    DSMALL_STORE = enable;
+
+}
+
+void sl2cfoam_set_dsmall_integral(sl2cfoam_dspin two_l_min) {
+
+    not_thread_safe();
+    sl2cfoam_dsmall_cache_clear();
+    DSMALL_INTEGRAL_TWO_L = two_l_min;
+
+}
+
+void sl2cfoam_set_boosters_shared_grid(bool enable) {
+
+    not_thread_safe();
+    BOOSTERS_SHARED_GRID = enable;
+
+}
+
+void sl2cfoam_set_b4_integration(int method) {
+
+    not_thread_safe();
+
+    switch (method)
+    {
+    case SL2CFOAM_B4_INTEGRATION_LOOP:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals with loops\n");
+        break;
+
+    case SL2CFOAM_B4_INTEGRATION_GEMM:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals with matrix products (BLAS: %s)\n", sl2cfoam_BLAS_vendor());
+        break;
+    
+    default:
+        error("wrong b4 integration method");
+    }
+
+    B4_INTEGRATION = method;
+
+}
+
+void sl2cfoam_set_b4_engine(int engine) {
+
+    not_thread_safe();
+
+    switch (engine)
+    {
+    case SL2CFOAM_B4_ENGINE_AUTO:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 algorithm chosen by cost\n");
+        break;
+
+    case SL2CFOAM_B4_ENGINE_INTEGRATE:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 with integrals of dsmall products\n");
+        break;
+
+    case SL2CFOAM_B4_ENGINE_FACTORIZED:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 with factorized 3j contractions\n");
+        break;
+    
+    default:
+        error("wrong b4 engine");
+    }
+
+    B4_ENGINE = engine;
+
+}
+
+void sl2cfoam_set_b4_tolerance(double tol) {
+
+    not_thread_safe();
+
+    if (tol < 0) {
+        error("negative b4 tolerance");
+    }
+
+    B4_TOLERANCE = tol;
+
+}
+
+void sl2cfoam_set_b4_quadrature(int rule) {
+
+    not_thread_safe();
+
+    switch (rule)
+    {
+    case SL2CFOAM_B4_QUADRATURE_GK:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals with Gauss-Kronrod rules\n");
+        break;
+
+    case SL2CFOAM_B4_QUADRATURE_NESTED:
+        verb(SL2CFOAM_VERBOSE_HIGH, "b4 integrals with nested rules\n");
+        break;
+    
+    default:
+        error("wrong b4 quadrature rule");
+    }
+
+    B4_QUADRATURE = rule;
+
+}
+
 void sl2cfoam_vector_free(sl2cfoam_vector v) {
     vector_free(v);
 }
@@ -64,6 +64,19 @@ typedef double sl2cfoam_spin;
 #define SL2CFOAM_ACCURACY_HIGH      1
 #define SL2CFOAM_ACCURACY_VERYHIGH  2
 
+// Methods for the integrals of the b4 coefficients.
+#define SL2CFOAM_B4_INTEGRATION_LOOP  0  // loop over magnetic indices, compensated sums
+#define SL2CFOAM_B4_INTEGRATION_GEMM  1  // matrix products with BLAS (default)
+
+// Algorithms for the b4 coefficients.
+#define SL2CFOAM_B4_ENGINE_AUTO        0  // cheaper algorithm for each spin configuration (default)
+#define SL2CFOAM_B4_ENGINE_INTEGRATE   1  // integrate dsmall products, then contract with 3j symbols
+#define SL2CFOAM_B4_ENGINE_FACTORIZED  2  // contract with 3j symbols at each abscissa, then integrate
+
+// Quadrature rules for the b4 integrals.
+#define SL2CFOAM_B4_QUADRATURE_GK      0  // 15- to 61-point Gauss-Kronrod, chosen by the spins j (default)
+#define SL2CFOAM_B4_QUADRATURE_NESTED  1  // nested Fejer rules, reusing the dsmall functions across levels
+
 // Contains general parameters for setup of the library.
 struct sl2cfoam_config {
     int             verbosity;               // verbosity level
@@ -120,6 +133,80 @@ void sl2cfoam_set_OMP(bool enable);
 // Returns if internal parallelization with OpenMP is enabled at runtime.
 bool sl2cfoam_get_OMP();
 
+// Sets the maximum memory (in MB) used to cache the dsmall functions
+// between b4 computations with the same spins (0 disables the cache).
+// Default is 256 MB. The cache is emptied when calling this function.
+void sl2cfoam_set_dsmall_cache(size_t MB);
+
+// Enables or disables storing the computed dsmall functions on disk
+// (folder dsmall next to the boosters folder) so that other runs
+// with the same spins, Immirzi, accuracy and grid can load them.
+// Disabled by default (no effect if compiled with NO_IO).
+void sl2cfoam_set_dsmall_store(bool enable);
+
+// Sets the smallest 2l from which the dsmall functions are computed
+// from their integral representation in double precision, falling back
+// to the exact Collet sums for the values with too large estimated error
+// (0 disables). The values agree with the exact ones within a tolerance
+// fixed by the accuracy. It pays off only for some spins (e.g. small j and
+// large l with a small Immirzi parameter) and it can be slower otherwise.
+// Disabled by default. The dsmall cache is emptied when calling this function.
+void sl2cfoam_set_dsmall_integral(sl2cfoam_dspin two_l_min);
+
+// Enables or disables using a single integration grid for all the
+// b4 coefficients of a booster tensor. The grid is the one of the
+// largest spins l = j + Dl, so that the dsmall functions are computed
+// only once per (j, l) and reused for all the l-tuples. The coefficients
+// with small l are integrated on more points than needed, so each of them
+// is slower to compute but not less accurate. This pays off when the dsmall
+// functions dominate the cost (large Immirzi, many shells), otherwise it
+// can be slightly slower.
+// Disabled by default (one grid per l-tuple).
+void sl2cfoam_set_boosters_shared_grid(bool enable);
+
+// Sets the method for the integrals of the b4 coefficients.
+// With SL2CFOAM_B4_INTEGRATION_GEMM the integrals are computed
+// with matrix products using the BLAS library (see sl2cfoam_BLAS_vendor),
+// the results agree with SL2CFOAM_B4_INTEGRATION_LOOP up to rounding errors.
+void sl2cfoam_set_b4_integration(int method);
+
+// Sets the algorithm for the b4 coefficients.
+// SL2CFOAM_B4_ENGINE_INTEGRATE computes the integrals of the products
+// of 4 dsmall functions for all the magnetic indices, then sums them with
+// the 3j symbols. SL2CFOAM_B4_ENGINE_FACTORIZED contracts each pair of
+// dsmall functions with the 3j symbols at every abscissa, then integrates
+// the products for all (i, k). The second is cheaper when the intertwiner
+// ranges are small compared to the magnetic ones or the spins are large
+// compared to the integration points. With SL2CFOAM_B4_ENGINE_AUTO
+// the algorithm is chosen for each b4 comparing the number of operations.
+void sl2cfoam_set_b4_engine(int engine);
+
+// Sets a target relative tolerance for the integrals of the b4 coefficients.
+// The integration grids start coarse and the intervals with the largest
+// errors are bisected until the error estimates of all the integrals meet
+// the tolerance (integrals below 1% of the largest ones are compared with
+// the latter). The dsmall functions are computed only at the abscissae of
+// the new intervals. The tolerance reached and
+// the number of intervals are stored in the tag of the booster tensors
+// (see sl2cfoam_boosters_tag). With 0 (default) the number of intervals
+// is fixed by the accuracy and large errors only print a warning.
+void sl2cfoam_set_b4_tolerance(double tol);
+
+// Sets the quadrature rule on the intervals of the b4 integration grids.
+// With SL2CFOAM_B4_QUADRATURE_GK the number of intervals grows with the
+// accuracy, so each accuracy has its own grid, and the points per interval
+// (15 to 61) are the fewest that keep the accuracy for the spins j and the
+// Immirzi parameter (61 for different spins j or when refining to meet a
+// tolerance). With SL2CFOAM_B4_QUADRATURE_NESTED
+// the intervals are the same for all accuracies and the accuracy (or the
+// tolerance) selects the level of a nested rule (63, 127, 255... points per
+// interval) whose abscissae contain the ones of the previous levels. The
+// levels for each accuracy (255 points for normal and high, 511 for very high)
+// are never less accurate than the Gauss-Kronrod grids.
+// The dsmall functions found in the cache for a previous level are reused
+// and computed only at the new abscissae.
+void sl2cfoam_set_b4_quadrature(int rule);
+
 
 ///////////////////////////////////////////////////////////////////////////
 // Booster functions.
@@ -129,6 +216,13 @@ bool sl2cfoam_get_OMP();
 // Indices: (i, k, l1, l2, l3, l4)
 TENSOR_INIT(boosters, 6);
 
+// Contents of the tag of the booster tensors
+// (all 0 for tensors computed by older versions).
+typedef struct sl2cfoam_boosters_tag {
+    double gk_err;    // largest relative error estimate of the b4 integrals
+    int intervals;    // largest number of intervals of the integration grids
+} sl2cfoam_boosters_tag;
+
 // Computes a boosters tensor.
 // gf parameter is the gauge-fixed index (1 to 4).
 // Spins order must match the order of the symbol (anti-clockwise).
@@ -151,6 +245,40 @@ sl2cfoam_tensor_boosters* sl2cfoam_boosters_load(int gf,
 sl2cfoam_dmatrix sl2cfoam_b4(sl2cfoam_dspin two_j1, sl2cfoam_dspin two_j2, sl2cfoam_dspin two_j3, sl2cfoam_dspin two_j4,
                              sl2cfoam_dspin two_l1, sl2cfoam_dspin two_l2, sl2cfoam_dspin two_l3, sl2cfoam_dspin two_l4);
 
+// Computes the b4^gamma(j_a, l_a; i, k) coefficients for n tuples of spins l.
+// The spins l are given in an array of size 4*n as (l1, l2, l3, l4) for each tuple.
+// The matrix (i, k) of tuple t is written in outs[t], which must point to
+// memory for dim(i) * dim(k) values (column-major, overwritten).
+// Tuples with no allowed intertwiner k are skipped.
+// The integration grid, the dsmall functions and the 3j symbols for the 
+// spins j are computed once and shared by all the tuples.
+void sl2cfoam_b4_batch(sl2cfoam_dspin two_j1, sl2cfoam_dspin two_j2, sl2cfoam_dspin two_j3, sl2cfoam_dspin two_j4,
+                       size_t n, sl2cfoam_dspin* two_ls, sl2cfoam_dmatrix* outs);
+
+// Workspace with the buffers and integration grids used for computing
+// the b4 coefficients. Passing the same workspace to many calls avoids
+// allocating memory each time: the buffers grow to the largest size
+// needed and then are reused. A workspace must not be used by concurrent calls.
+typedef struct sl2cfoam_b4_workspace sl2cfoam_b4_workspace;
+
+// Creates an empty workspace.
+sl2cfoam_b4_workspace* sl2cfoam_b4_workspace_create();
+
+// Empties the workspace for a new sequence of calls, keeping its buffers
+// (grown to the largest size used so far) and integration grids.
+void sl2cfoam_b4_workspace_reset(sl2cfoam_b4_workspace* ws);
+
+// Releases all the memory held by the workspace, which can still be used.
+void sl2cfoam_b4_workspace_trim(sl2cfoam_b4_workspace* ws);
+
+// Frees the workspace.
+void sl2cfoam_b4_workspace_free(sl2cfoam_b4_workspace* ws);
+
+// As sl2cfoam_b4_batch but using the given workspace.
+void sl2cfoam_b4_batch_ws(sl2cfoam_b4_workspace* ws,
+                          sl2cfoam_dspin two_j1, sl2cfoam_dspin two_j2, sl2cfoam_dspin two_j3, sl2cfoam_dspin two_j4,
+                          size_t n, sl2cfoam_dspin* two_ls, sl2cfoam_dmatrix* outs);
+
 // Computes the b4^gamma(j_a, l_a; i, k) coefficients using adaptive integration
 // for given range of intertwiners.
 // The result is more accurate but very slow. Useful for testing the fast version.
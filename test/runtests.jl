@@ -2,5 +2,31 @@ using Test
 using SL2CBoosters
 
 @testset "SL2CBoosters.jl" begin
-    # Add your tests here
+
+    SL2CBoosters.cinit(mktempdir(), 1.2, SL2CBoosters.Config(VerbosityOff, NormalAccuracy, 10, 0))
+
+    @testset "b4_batch_compute" begin
+
+        js = [1, 1, 1, 1]
+        lss = [ [1, 1, 1, 1], [2, 1, 1, 2], [2, 2, 1, 1], [3, 2, 2, 3] ]
+
+        b4s = [ b4_compute(js, ls) for ls in lss ]
+
+        @test all(b4_batch_compute(js, lss) .≈ b4s)
+
+        # the same workspace for many batches
+        ws = B4Workspace()
+        @test all(b4_batch_compute(js, lss, ws) .≈ b4s)
+        @test all(b4_batch_compute(js, reverse(lss), ws) .≈ reverse(b4s))
+
+        workspace_reset!(ws)
+        @test all(b4_batch_compute(js, lss, ws) .≈ b4s)
+
+        workspace_trim!(ws)
+        @test all(b4_batch_compute(js, lss, ws) .≈ b4s)
+
+    end
+
+    SL2CBoosters.cclear()
+
 end